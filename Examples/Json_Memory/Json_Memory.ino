@@ -0,0 +1,118 @@
+/*
+ Sample sketch to check where aJson gets its memory from: your own
+ allocator, a pool of nodes, measuring trees and parsing straight into
+ structs without allocating anything.
+
+ Every check prints OK or FAIL on the serial port.
+
+ Circuit:
+
+    You don't need any circuit, but need the Arduino board
+ */
+#include <aJSON.h>
+
+unsigned int failures = 0;
+
+void check(const __FlashStringHelper* name, bool ok) {
+  Serial.print(ok ? F("OK   ") : F("FAIL "));
+  Serial.println(name);
+  if (!ok) {
+    failures++;
+  }
+}
+
+// An allocator that counts the bytes it hands out and gets back.
+long in_use = 0;
+
+void* countingAlloc(void* context, size_t size) {
+  (void) context;
+  void* block = malloc(size);
+  if (block != NULL) {
+    in_use += size;
+  }
+  return block;
+}
+
+void countingRelease(void* context, void* ptr, size_t size) {
+  (void) context;
+  in_use -= size;
+  free(ptr);
+}
+
+const aJsonAllocator counting = { countingAlloc, countingRelease, NULL };
+
+char json[] = "{\"id\":7,\"value\":21.5,\"valid\":true,\"unit\":\"celsius\",\"extra\":[1,2]}";
+
+void testAllocator() {
+  aJsonStringStream stream(json);
+  stream.setAllocator(&counting);
+  aJsonObject* root = aJson.parse(&stream);
+  check(F("allocator"), root != NULL && in_use > 0);
+
+  aJsonMemoryStats stats;
+  aJson.measure(root, &stats);
+  check(F("measure"), stats.nodes == 8 && stats.bytes == (unsigned long) in_use);
+
+  aJson.deleteItem(root, &counting);
+  check(F("everything released"), in_use == 0);
+}
+
+void testNodePool() {
+  static aJsonObject nodes[10];
+  aJsonNodePool pool;
+  aJsonNodePoolInit(&pool, nodes, sizeof(aJsonObject), 10, 0);
+  aJson.setNodePool(&pool);
+
+  aJsonObject* root = aJson.parse(json);
+  check(F("node pool"), root != NULL && pool.used == 8 && pool.misses == 0);
+  aJson.deleteItem(root);
+  check(F("nodes recycled"), pool.used == 0 && pool.peak == 8);
+
+  char big[] = "[1,2,3,4,5,6,7,8,9,10,11]";
+  check(F("pool without fallback"), aJson.parse(big) == NULL && pool.misses > 0);
+  check(F("nothing left over"), pool.used == 0);
+
+  aJson.setNodePool(NULL);
+}
+
+struct Reading {
+  int id;
+  float value;
+  bool valid;
+  char unit[4];
+};
+
+const aJsonField readingFields[] = {
+  aJson_INT_FIELD(Reading, id, "id"),
+  aJson_FLOAT_FIELD(Reading, value, "value"),
+  aJson_BOOL_FIELD(Reading, valid, "valid"),
+  aJson_STRING_FIELD(Reading, unit, "unit")
+};
+
+void testStructs() {
+  Reading reading = { 0, 0, false, "" };
+  aJsonStringStream in(json);
+  check(F("parse struct"), aJson.parseStruct(&in, &reading, readingFields) == 0
+      && reading.id == 7 && reading.value == 21.5 && reading.valid
+      && strcmp(reading.unit, "cel") == 0);
+
+  char out[64];
+  aJsonStringStream printed(NULL, out, sizeof(out));
+  aJson.printStruct(&printed, &reading, readingFields);
+  aJsonStringStream again(out);
+  Reading copy = { 0, 0, false, "" };
+  check(F("print struct"), aJson.parseStruct(&again, &copy, readingFields) == 0
+      && copy.id == reading.id && copy.value == reading.value
+      && copy.valid == reading.valid && strcmp(copy.unit, reading.unit) == 0);
+}
+
+void setup() {
+  Serial.begin(9600);
+  testAllocator();
+  testNodePool();
+  testStructs();
+  Serial.println(failures == 0 ? F("all passed") : F("some failed"));
+}
+
+void loop() {
+}
@@ -0,0 +1,148 @@
+/*
+ Sample sketch to check keeping copies of a state in step: JSON Patch and
+ merge patches, comparing and hashing trees, the parse cache, sharing
+ trees and publishing frozen documents.
+
+ Every check prints OK or FAIL on the serial port.
+
+ Circuit:
+
+    You don't need any circuit, but need the Arduino board
+ */
+#include <aJSON.h>
+
+unsigned int failures = 0;
+aJsonPublisher config;
+
+void check(const __FlashStringHelper* name, bool ok) {
+  Serial.print(ok ? F("OK   ") : F("FAIL "));
+  Serial.println(name);
+  if (!ok) {
+    failures++;
+  }
+}
+
+void testPatches() {
+  char sent[] = "{\"mode\":\"run\",\"speed\":3,\"log\":[1,2,3]}";
+  char now[] = "{\"mode\":\"idle\",\"log\":[1,2,3,4],\"Speed\":3}";
+  aJsonObject* last = aJson.parse(sent);
+  aJsonObject* state = aJson.parse(now);
+
+  aJsonObject* patch = aJson.diff(last, state);
+  check(F("diff and apply"), patch != NULL && aJson.applyPatch(last, patch) == 0
+      && aJson.equals(last, state));
+  aJson.deleteItem(patch);
+
+  char mixed[] = "{\"a\":2,\"A\":1}";
+  char lower[] = "{\"a\":2}";
+  aJsonObject* both = aJson.parse(mixed);
+  aJsonObject* one = aJson.parse(lower);
+  patch = aJson.diff(both, one);
+  check(F("names differing in case"), patch != NULL && aJson.applyPatch(both, patch) == 0
+      && aJson.equals(both, one) && aJson.getPathItem(both, "/a") != NULL);
+  aJson.deleteItem(patch);
+  aJson.deleteItem(one);
+  aJson.deleteItem(both);
+
+  char merge[] = "{\"mode\":\"stop\",\"Speed\":null,\"MODE\":1}";
+  aJsonStringStream stream(merge);
+  check(F("merge patch"), aJson.mergePatch(state, &stream) == 0
+      && strcmp(aJson.getPathItem(state, "/mode")->valuestring, "stop") == 0
+      && aJson.getPathItem(state, "/MODE")->valueint == 1
+      && aJson.getObjectItem(state, "speed") == NULL);
+
+  aJson.deleteItem(state);
+  aJson.deleteItem(last);
+}
+
+void testComparing() {
+  char one[] = "{\"a\":1,\"b\":[true,null]}";
+  char other[] = "{\"b\":[true,null],\"a\":1}";
+  aJsonObject* a = aJson.parse(one);
+  aJsonObject* b = aJson.parse(other);
+  check(F("equals"), aJson.equals(a, b));
+  check(F("hash"), aJson.hash(a) == aJson.hash(b));
+
+  char out[32];
+  aJsonStringStream canonical(NULL, out, sizeof(out));
+  check(F("canonical printing"), aJson.printCanonical(b, &canonical) == 0
+      && strcmp(out, one) == 0);
+
+  aJson.replaceItemInObject(b, "a", aJson.createItem(2));
+  check(F("not equal"), !aJson.equals(a, b) && aJson.hash(a) != aJson.hash(b));
+  aJson.deleteItem(b);
+  aJson.deleteItem(a);
+}
+
+void testCache() {
+  aJsonCacheEntry entries[2];
+  aJsonParseCache cache(entries, 2);
+  aJson.setParseCache(&cache);
+
+  char text[] = "{\"interval\":60}";
+  aJsonObject* first = aJson.parse(text);
+  aJsonObject* again = aJson.parse(text);
+  check(F("cache hit"), first != NULL && first == again
+      && cache.getHits() == 1 && cache.getMisses() == 1);
+  aJsonObject* extra = aJson.createNull();
+  check(F("cached trees are frozen"), aJson.isFrozen(first)
+      && aJson.addItemToObject(first, "x", extra) == EOF);
+  aJson.deleteItem(extra);
+  aJsonObject* list = aJson.createArray();
+  check(F("cached trees stay with the cache"), aJson.addItemToArray(list, again) == EOF);
+  aJson.deleteItem(list);
+  aJson.deleteItem(again);
+  aJson.deleteItem(first);
+
+  aJson.setParseCache(NULL);
+  cache.clear();
+}
+
+void testSharing() {
+  char text[] = "{\"mode\":\"run\",\"limits\":{\"max\":5}}";
+  aJsonObject* state = aJson.parse(text);
+  aJsonObject* snapshot = aJson.share(state);
+  aJson.replaceItemInObject(state, "mode", aJson.createItem("idle"));
+  check(F("share"), strcmp(aJson.getObjectItem(snapshot, "mode")->valuestring, "run") == 0);
+
+  aJsonObject* limits = aJson.getObjectItem(state, "limits");
+  aJson.unshare(limits);
+  aJson.replaceItemInObject(limits, "max", aJson.createItem(9));
+  check(F("unshare"), aJson.getPathItem(snapshot, "/limits/max")->valueint == 5
+      && aJson.getPathItem(state, "/limits/max")->valueint == 9);
+  aJson.deleteItem(state);
+  aJson.deleteItem(snapshot);
+}
+
+void testPublishing() {
+  char first[] = "{\"version\":1}";
+  char second[] = "{\"version\":2}";
+
+  check(F("publish"), config.publish(aJson.parse(first)) == 0);
+  aJsonObject* reading = config.acquire();
+  aJsonObject* version = aJson.createItem(3);
+  check(F("published documents are frozen"), aJson.isFrozen(reading)
+      && aJson.replaceItemInObject(reading, "version", version) == EOF);
+  aJson.deleteItem(version);
+
+  config.publish(aJson.parse(second));
+  aJsonObject* current = config.acquire();
+  check(F("readers keep their version"), aJson.getObjectItem(reading, "version")->valueint == 1
+      && aJson.getObjectItem(current, "version")->valueint == 2);
+  config.release(current);
+  config.release(reading);
+  check(F("reclaim"), config.reclaim() == 0);
+}
+
+void setup() {
+  Serial.begin(9600);
+  testPatches();
+  testComparing();
+  testCache();
+  testSharing();
+  testPublishing();
+  Serial.println(failures == 0 ? F("all passed") : F("some failed"));
+}
+
+void loop() {
+}
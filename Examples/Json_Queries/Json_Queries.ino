@@ -0,0 +1,154 @@
+/*
+ Sample sketch to check the ways of getting at parts of a document:
+ paths, projecting streams, passing JSON through, splitting and reading
+ arrays and the packed, lazy and raw number parsing options.
+
+ Every check prints OK or FAIL on the serial port.
+
+ Circuit:
+
+    You don't need any circuit, but need the Arduino board
+ */
+#include <aJSON.h>
+
+char json[] = "{\"query\":{\"count\":2,\"results\":[{\"title\":\"first\"},{\"title\":\"second\"}]},"
+  "\"samples\":[1.5,2.25,3.5],\"mixed\":[1,2.5],\"reading\":21.50}";
+
+unsigned int failures = 0;
+
+void check(const __FlashStringHelper* name, bool ok) {
+  Serial.print(ok ? F("OK   ") : F("FAIL "));
+  Serial.println(name);
+  if (!ok) {
+    failures++;
+  }
+}
+
+void testPaths() {
+  aJsonObject* root = aJson.parse(json);
+  aJsonPath* title = aJson.compilePath("query.results[1].title");
+  aJsonPath* count = aJson.compilePath("/query/count");
+  aJsonObject* item = aJson.getPathItem(root, title);
+  check(F("dotted path"), item != NULL && strcmp(item->valuestring, "second") == 0);
+
+  aJsonObject* values[2];
+  aJsonPath* paths[] = { title, count };
+  check(F("several paths"), aJson.getPathItems(root, paths, 2, values) == 2
+      && values[1]->valueint == 2);
+  aJson.deleteItem(root);
+
+  aJsonStringStream stream(json);
+  aJsonObject* tiny = aJson.project(&stream, paths, 2, values, true);
+  check(F("projection"), tiny != NULL && values[0] != NULL
+      && strcmp(values[0]->valuestring, "second") == 0
+      && aJson.getObjectItem(tiny, "samples") == NULL);
+  aJson.deleteItem(tiny);
+
+  aJson.deletePath(title);
+  aJson.deletePath(count);
+}
+
+void testPassingThrough() {
+  char in[] = "{ \"a\" : [ 1 , true ] }";
+  char out[32];
+  aJsonStringStream input(in);
+  aJsonStringStream output(NULL, out, sizeof(out));
+  check(F("transcode"), aJson.transcode(&input, &output) == 0
+      && strcmp(out, "{\"a\":[1,true]}") == 0);
+
+  char broken[] = "[1,,2]";
+  aJsonStringStream bad(broken);
+  aJsonError error;
+  check(F("validate"), aJson.validate(&bad, &error) == EOF
+      && error.offset == 3 && error.reason == aJson_ErrorUnexpected);
+
+  char zero[] = "01";
+  aJsonStringStream leading(zero);
+  check(F("leading zeros"), aJson.validate(&leading, &error) == EOF
+      && error.offset == 1 && error.reason == aJson_ErrorNumber);
+
+  char trailing[] = "[1] x ";
+  aJsonStringStream garbage(trailing);
+  check(F("nothing after the value"), aJson.validate(&garbage, &error) == EOF
+      && error.offset == 4 && error.reason == aJson_ErrorUnexpected);
+}
+
+void testArrays() {
+  const char list[] = "[{\"id\":1},{\"id\":2},[3],4]";
+  aJsonText elements[4];
+  int count = aJson.splitArray(list, strlen(list), elements, 4);
+  aJsonObject* first = aJson.parseElements(elements, 2);
+  aJsonObject* rest = aJson.parseElements(elements + 2, count - 2);
+  check(F("split array"), count == 4 && first != NULL && rest != NULL
+      && aJson.appendArray(first, rest) == 0 && aJson.getArraySize(first) == 4);
+  aJson.deleteItem(rest);
+  aJson.deleteItem(first);
+
+  char records[] = "[{\"id\":1},{\"id\":2},{\"id\":3}]";
+  aJsonStringStream stream(records);
+  aJsonArrayReader reader(&stream);
+  int sum = 0;
+  aJsonObject* record;
+  while ((record = reader.next()) != NULL) {
+    sum += aJson.getObjectItem(record, "id")->valueint;
+  }
+  check(F("array reader"), sum == 6 && !reader.failed() && reader.read() == 3);
+}
+
+void testNumbers() {
+  aJsonStringStream packed_stream(json);
+  packed_stream.setOptions(aJson_PackNumbers);
+  aJsonObject* root = aJson.parse(&packed_stream);
+  unsigned char count;
+  double* samples = aJson.getFloatArray(aJson.getObjectItem(root, "samples"), &count);
+  check(F("packed numbers"), samples != NULL && count == 3 && samples[2] == 3.5);
+  aJsonObject* mixed = aJson.getObjectItem(root, "mixed");
+  check(F("mixed numbers keep their types"), aJson.getFloatArray(mixed, &count) == NULL
+      && aJson.getArrayItem(mixed, 0)->type == aJson_Int);
+  size_t length = aJson.printedLength(root);
+  char* text = (char*) malloc(length + 1);
+  check(F("printed length"), text != NULL && aJson.print(root, text, length + 1) == length
+      && strlen(text) == length);
+  free(text);
+  aJson.deleteItem(root);
+
+  root = aJson.parse(json, aJson_LazyParse);
+  check(F("lazy parsing"), root != NULL
+      && aJson.getPathItem(root, "/query/results/0/title") != NULL);
+  aJson.deleteItem(root);
+
+  aJsonStringStream raw_stream(json);
+  raw_stream.setOptions(aJson_RawNumbers);
+  root = aJson.parse(&raw_stream);
+  char out[128];
+  aJson.print(root, out, sizeof(out));
+  check(F("raw numbers"), aJson.getFloat(aJson.getObjectItem(root, "reading")) == 21.5
+      && strstr(out, "21.50") != NULL);
+  aJson.deleteItem(root);
+
+  char big[] = "[12345678901234567890]";
+  aJsonStringStream big_stream(big);
+  big_stream.setOptions(aJson_RawNumbers);
+  root = aJson.parse(&big_stream);
+  aJsonStringStream canonical(NULL, out, sizeof(out));
+  check(F("big integers"), root != NULL && aJson.getArrayItem(root, 0)->type == aJson_Float
+      && aJson.printCanonical(root, &canonical) == 0 && strcmp(out, big) == 0);
+  aJson.deleteItem(root);
+
+  char zeros[] = "[007]";
+  aJsonStringStream zero_stream(zeros);
+  zero_stream.setOptions(aJson_RawNumbers);
+  check(F("raw leading zeros"), aJson.parse(&zero_stream) == NULL);
+}
+
+void setup() {
+  Serial.begin(9600);
+  testPaths();
+  testPassingThrough();
+  testArrays();
+  testNumbers();
+  Serial.println(failures == 0 ? F("all passed") : F("some failed"));
+}
+
+void loop() {
+}
@@ -26,19 +26,17 @@ void setup()
   Serial.begin(9600);
 }
 
-/* Generate message like: { "analog": [0, 200, 400, 600, 800, 1000] } */
-aJsonObject *createMessage()
+/* Send message like: { "analog": [0, 200, 400, 600, 800, 1000] } */
+void sendMessage()
 {
-  aJsonObject *msg = aJson.createObject();
-
-  int analogValues[6];
+  serial_stream.beginObject();
+  serial_stream.key("analog");
+  serial_stream.beginArray();
   for (int i = 0; i < 6; i++) {
-    analogValues[i] = analogRead(i);
+    serial_stream.value(analogRead(i));
   }
-  aJsonObject *analog = aJson.createIntArray(analogValues, 6);
-  aJson.addItemToObject(msg, "analog", analog);
-
-  return msg;
+  serial_stream.endArray();
+  serial_stream.endObject();
 }
 
 /* Process message like: { "pwm": { "8": 0, "9": 128 } } */
@@ -78,10 +76,8 @@ void loop()
 {
   if (millis() - last_print > 1000) {
     /* One second elapsed, send message. */
-    aJsonObject *msg = createMessage();
-    aJson.print(msg, &serial_stream);
+    sendMessage();
     Serial.println(); /* Add newline. */
-    aJson.deleteItem(msg);
     last_print = millis();
   }
 
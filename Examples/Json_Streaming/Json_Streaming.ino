@@ -0,0 +1,114 @@
+/*
+ Sample sketch to check writing and reading JSON a piece at a time:
+ writing without a tree, serializing to a slow client and parsing
+ without waiting for the whole document.
+
+ Every check prints OK or FAIL on the serial port.
+
+ Circuit:
+
+    You don't need any circuit, but need the Arduino board
+ */
+#include <aJSON.h>
+
+unsigned int failures = 0;
+
+void check(const __FlashStringHelper* name, bool ok) {
+  Serial.print(ok ? F("OK   ") : F("FAIL "));
+  Serial.println(name);
+  if (!ok) {
+    failures++;
+  }
+}
+
+// Takes only a few characters per call, like a client with a small send buffer.
+class SlowClient : public Print {
+public:
+  SlowClient() : length(0), room(0) { text[0] = 0; }
+  virtual size_t write(uint8_t ch) {
+    if (room == 0 || length + 1 >= sizeof(text)) {
+      return 0;
+    }
+    room--;
+    text[length++] = ch;
+    text[length] = 0;
+    return 1;
+  }
+  using Print::write;
+  char text[64];
+  size_t length, room;
+};
+
+void testWriter() {
+  char out[64];
+  aJsonStringStream stream(NULL, out, sizeof(out));
+  stream.beginObject();
+  stream.key("sensor");
+  stream.value("kitchen");
+  stream.key("readings");
+  stream.beginArray();
+  for (int i = 0; i < 3; i++) {
+    stream.value(i * 10);
+  }
+  stream.endArray();
+  stream.key("ok");
+  stream.value(true);
+  check(F("writer"), stream.endObject() == 0
+      && strcmp(out, "{\"sensor\":\"kitchen\",\"readings\":[0,10,20],\"ok\":true}") == 0);
+
+  aJsonStringStream wrong(NULL, out, sizeof(out));
+  wrong.beginObject();
+  check(F("writer wants keys"), wrong.value(1) == EOF);
+}
+
+void testSerializer() {
+  char json[] = "{\"name\":\"Jack (\\\"Bee\\\") Nimble\",\"size\":[1920,1080]}";
+  aJsonObject* root = aJson.parse(json);
+  char expected[64];
+  aJson.print(root, expected, sizeof(expected));
+
+  aJsonSerializer serializer(root);
+  SlowClient client;
+  int calls = 0;
+  while (!serializer.done() && calls < 100) {
+    client.room = 3;
+    serializer.write(&client);
+    calls++;
+  }
+  check(F("serializer"), !serializer.failed() && calls > 1
+      && strcmp(client.text, expected) == 0 && serializer.produced() == client.length);
+  aJson.deleteItem(root);
+}
+
+void testParser() {
+  char buffer[64];
+  aJsonParser parser(buffer, sizeof(buffer));
+  const char* arriving[] = { "{\"temp\":", "21,\"unit\"", ":\"C\"}{\"temp\":22}" };
+  aJsonObject* msg = NULL;
+  for (int i = 0; i < 3 && msg == NULL; i++) {
+    size_t used = parser.feed(arriving[i], strlen(arriving[i]));
+    if (parser.ready()) {
+      check(F("parser stops after the document"), used == 5);
+      msg = parser.take();
+    }
+  }
+  check(F("parser"), msg != NULL && aJson.getObjectItem(msg, "temp")->valueint == 21
+      && !parser.ready());
+  aJson.deleteItem(msg);
+
+  char small[4];
+  aJsonParser tiny(small, sizeof(small));
+  tiny.feed("[1,2,3]", 7);
+  check(F("parser buffer too small"), tiny.failed());
+}
+
+void setup() {
+  Serial.begin(9600);
+  testWriter();
+  testSerializer();
+  testParser();
+  Serial.println(failures == 0 ? F("all passed") : F("some failed"));
+}
+
+void loop() {
+}
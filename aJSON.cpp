@@ -35,9 +35,11 @@
 #include <math.h>
 #include <stdlib.h>
 #include <float.h>
+#include <limits.h>
 #include <ctype.h>
 #ifdef __AVR__
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 #else
 #include <pgmspace.h>
 #endif
@@ -53,6 +55,43 @@
 //how much digits after . for float
 #define FLOAT_PRECISION 5
 
+//how much of a key project() keeps to compare it with the paths, longer
+//keys never match
+#define PROJECTION_KEY_LEN 64
+//marks a path project() is done with
+#define PROJECTION_DONE 255
+
+//longest JSON Pointer diff() writes, deeper changes replace their parent
+#define PATCH_PATH_LEN 128
+
+// State of aJsonClass::project() passed down the recursion.
+struct aJsonProjection {
+  aJsonPath **paths;
+  aJsonObject **values; // may be NULL
+  unsigned char count;
+  unsigned char pending; // paths not resolved yet
+  bool stop; // stop reading once pending is 0
+};
+
+// Makes an allocator the current one for as long as it is in scope.
+class aJsonAllocatorScope {
+public:
+  aJsonAllocatorScope(const aJsonAllocator *allocator)
+    : active(allocator != NULL), previous(NULL)
+  {
+    if (active)
+      previous = aJsonUseAllocator(allocator);
+  }
+  ~aJsonAllocatorScope()
+  {
+    if (active)
+      aJsonUseAllocator(previous);
+  }
+private:
+  bool active;
+  const aJsonAllocator *previous;
+};
+
 
 bool
 aJsonStream::available()
@@ -79,6 +118,7 @@ aJsonStream::getch()
     {
       int ret = bucket;
       bucket = EOF;
+      consumed++;
       return ret;
     }
   // In case input was malformed - can happen, this is the
@@ -87,13 +127,18 @@ aJsonStream::getch()
   // stream()->available() forever, hence the 500ms timeout.
   unsigned long i= millis()+500;
   while ((!stream()->available()) && (millis() < i)) /* spin with a timeout*/;
-  return stream()->read();
+  int ch = stream()->read();
+  if (ch != EOF)
+    consumed++;
+  return ch;
 }
 
 void
 aJsonStream::ungetch(char ch)
 {
-  bucket = ch;
+  bucket = (ch == EOF) ? EOF : (unsigned char) ch;
+  if (bucket != EOF)
+    consumed--;
 }
 
 size_t
@@ -125,6 +170,7 @@ aJsonClientStream::getch()
     {
       int ret = bucket;
       bucket = EOF;
+      consumed++;
       return ret;
     }
   while (!stream()->available() && stream()->connected()) /* spin */;
@@ -133,6 +179,7 @@ aJsonClientStream::getch()
       stream()->stop();
       return EOF;
     }
+  consumed++;
   return stream()->read();
 }
 
@@ -151,22 +198,33 @@ aJsonStringStream::getch()
     {
       int ret = bucket;
       bucket = EOF;
+      consumed++;
       return ret;
     }
   if (!inbuf || !inbuf_len)
     {
       return EOF;
     }
-  char ch = *inbuf++;
+  //bytes above 127 must not look like EOF or control characters
+  unsigned char ch = *inbuf++;
   inbuf_len--;
+  consumed++;
   return ch;
 }
 
+const char*
+aJsonStringStream::position()
+{
+  //the bucket can only hold what was read last
+  return (bucket != EOF) ? inbuf - 1 : inbuf;
+}
+
 size_t
 aJsonStringStream::write(uint8_t ch)
 {
   if (!outbuf || outbuf_len <= 1)
     {
+      dropped++;
       return 0;
     }
   *outbuf++ = ch; outbuf_len--;
@@ -174,48 +232,266 @@ aJsonStringStream::write(uint8_t ch)
   return 1;
 }
 
+size_t
+aJsonStringStream::write(const uint8_t *buffer, size_t size)
+{
+  size_t room = (outbuf && outbuf_len > 1) ? outbuf_len - 1 : 0;
+  size_t n = (size < room) ? size : room;
+  if (n)
+    {
+      memcpy(outbuf, buffer, n);
+      outbuf += n; outbuf_len -= n;
+      *outbuf = 0;
+    }
+  dropped += size - n;
+  return n;
+}
+
+// Counts what is printed to it instead of storing it.
+class aJsonCountingStream : public aJsonStream {
+public:
+  aJsonCountingStream()
+    : aJsonStream(NULL), count(0)
+  {}
+  size_t count;
+private:
+  virtual size_t write(uint8_t)
+  {
+    count++;
+    return 1;
+  }
+  virtual size_t write(const uint8_t *, size_t size)
+  {
+    count += size;
+    return size;
+  }
+};
+
+// Packed arrays keep their numbers right behind the header.
+static size_t
+aJsonPackedSize(char type, unsigned char capacity)
+{
+  return sizeof(aJsonPacked)
+      + capacity * (type == aJson_Int ? sizeof(int) : sizeof(double));
+}
+
+static aJsonPacked*
+aJsonNewPacked(char type, unsigned char capacity)
+{
+  aJsonPacked *packed = (aJsonPacked*) aJsonMalloc(aJsonPackedSize(type,
+      capacity));
+  if (packed)
+    {
+      packed->count = 0;
+      packed->capacity = capacity;
+      packed->type = type;
+      packed->ints = (int*) (packed + 1);
+      if (type != aJson_Int)
+        packed->floats = (double*) (packed + 1);
+    }
+  return packed;
+}
+
+static void
+aJsonFreePacked(aJsonPacked *packed)
+{
+  if (packed)
+    aJsonFree(packed, aJsonPackedSize(packed->type, packed->capacity));
+}
+
+// Raw numbers keep their text right behind the header.
+static void
+aJsonFreeRaw(aJsonRaw *raw)
+{
+  if (raw)
+    aJsonFree(raw, sizeof(aJsonRaw) + strlen(raw->text) + 1);
+}
+
+static aJsonRaw*
+aJsonCopyRaw(aJsonRaw *raw)
+{
+  size_t size = sizeof(aJsonRaw) + strlen(raw->text) + 1;
+  aJsonRaw *copy = (aJsonRaw*) aJsonMalloc(size);
+  if (copy)
+    {
+      memcpy(copy, raw, size);
+      copy->text = (char*) (copy + 1);
+    }
+  return copy;
+}
+
+// Copy the values of a packed array into a new one of type and capacity.
+static aJsonPacked*
+aJsonCopyPacked(aJsonPacked *packed, char type, unsigned char capacity)
+{
+  aJsonPacked *copy = aJsonNewPacked(type, capacity);
+  if (!copy || !packed)
+    return copy;
+  copy->count = packed->count < capacity ? packed->count : capacity;
+  for (unsigned char i = 0; i < copy->count; i++)
+    {
+      if (type == aJson_Int)
+        copy->ints[i] = packed->ints[i];
+      else if (packed->type == aJson_Int)
+        copy->floats[i] = packed->ints[i];
+      else
+        copy->floats[i] = packed->floats[i];
+    }
+  return copy;
+}
 
 // Internal constructor.
 aJsonObject*
 aJsonClass::newItem()
 {
-  aJsonObject* node = (aJsonObject*) malloc(sizeof(aJsonObject));
+  aJsonObject* node = (aJsonObject*) aJsonMallocNode(sizeof(aJsonObject));
   if (node)
     memset(node, 0, sizeof(aJsonObject));
   return node;
 }
 
+// Free the children and string of an item, but keep the item itself.
+void
+aJsonClass::deleteValue(aJsonObject *c)
+{
+  if (c->flags & aJson_Shared)
+    {
+      //the children go with the last item that has them
+      if (--c->valueshare->users == 0)
+        aJsonFree(c->valueshare, sizeof(aJsonShare));
+      else
+        c->child = NULL;
+      c->valueshare = NULL;
+    }
+  if (c->child)
+    {
+      deleteList(c->child);
+    }
+  if ((c->type == aJson_String) && c->valuestring)
+    {
+      aJsonFreeString(c->valuestring);
+    }
+  if (c->flags & aJson_Packed)
+    {
+      aJsonFreePacked(c->valuepacked);
+    }
+  if (c->flags & aJson_Raw)
+    {
+      aJsonFreeRaw(c->valueraw);
+    }
+  c->child = NULL;
+  c->valuetext.start = NULL;
+  c->valuetext.length = 0;
+  c->flags &= ~(aJson_Packed | aJson_Lazy | aJson_Raw | aJson_Shared
+      | (0xff << aJson_LazyShift));
+  c->type = aJson_NULL;
+}
+
+// Whether item must not be changed.
+static bool
+aJsonIsFrozen(aJsonObject *item)
+{
+  return item && (item->flags & (aJson_Frozen | aJson_Lazy)) == aJson_Frozen;
+}
+
+// Free the name of an item unless it is borrowed.
+static void
+aJsonFreeName(aJsonObject *item)
+{
+  if (item->name && !(item->flags & aJson_StaticName))
+    {
+      aJsonFreeString(item->name);
+    }
+  item->name = NULL;
+  item->flags &= ~aJson_StaticName;
+}
+
+// Delete a aJsonObject structure allocated by a specific allocator.
+void
+aJsonClass::deleteItem(aJsonObject *c, const aJsonAllocator *allocator)
+{
+  aJsonAllocatorScope scope(allocator);
+  deleteItem(c);
+}
+
+// The cache answering parse(char*), if any.
+static aJsonParseCache *aJsonActiveCache = NULL;
+
 // Delete a aJsonObject structure.
 void
 aJsonClass::deleteItem(aJsonObject *c)
+{
+  if (aJsonActiveCache != NULL && aJsonActiveCache->release(c))
+    {
+      return; // shared, freed when it leaves the cache
+    }
+  deleteList(c);
+}
+
+// Delete c and its siblings, which cannot belong to the cache.
+void
+aJsonClass::deleteList(aJsonObject *c)
 {
   aJsonObject *next;
   while (c)
     {
       next = c->next;
-      if (!(c->type & aJson_IsReference) && c->child)
-        {
-          deleteItem(c->child);
-        }
-      if ((c->type == aJson_String) && c->valuestring)
-        {
-          free(c->valuestring);
-        }
-      if (c->name)
-        {
-          free(c->name);
-        }
-      free(c);
+      deleteValue(c);
+      aJsonFreeName(c);
+      aJsonFreeNode(c, sizeof(aJsonObject));
       c = next;
     }
 }
 
+// Swap the values of two items, their names and siblings stay where they are.
+static void
+aJsonSwapValues(aJsonObject *a, aJsonObject *b)
+{
+  aJsonObject tmp = *a;
+  *a = *b;
+  a->name = tmp.name;
+  a->next = tmp.next;
+  a->prev = tmp.prev;
+  a->flags = (a->flags & ~aJson_StaticName) | (tmp.flags & aJson_StaticName);
+  tmp.name = b->name;
+  tmp.next = b->next;
+  tmp.prev = b->prev;
+  tmp.flags = (tmp.flags & ~aJson_StaticName) | (b->flags & aJson_StaticName);
+  *b = tmp;
+}
+
+// The member of object called name, unlike getObjectItem() minding case.
+static aJsonObject*
+aJsonFindMember(aJsonObject *object, const char *name)
+{
+  aJsonObject *c = object->child;
+  while (c && strcmp(c->name, name))
+    c = c->next;
+  return c;
+}
+
+// Take c out of the children of parent.
+static void
+aJsonUnlink(aJsonObject *parent, aJsonObject *c)
+{
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    parent->child = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+  c->prev = c->next = NULL;
+}
+
 // Parse the input text to generate a number, and populate the result into item.
 int
 aJsonStream::parseNumber(aJsonObject *item)
 {
   int i = 0;
   int sign = 1;
+  //integers too big for an int become doubles
+  bool overflow = false;
+  double big = 0;
 
   int in = this->getch();
   if (in == EOF)
@@ -237,12 +513,20 @@ aJsonStream::parseNumber(aJsonObject *item)
   if (in >= '0' && in <= '9')
     do
       {
-        i = (i * 10) + (in - '0');
+        if (!overflow && i > (INT_MAX - (in - '0')) / 10)
+          {
+            overflow = true;
+            big = i;
+          }
+        if (overflow)
+          big = (big * 10.0) + (in - '0');
+        else
+          i = (i * 10) + (in - '0');
         in = this->getch();
       }
     while (in >= '0' && in <= '9'); // Number?
   //end of integer part � or isn't it?
-  if (!(in == '.' || in == 'e' || in == 'E'))
+  if (!overflow && !(in == '.' || in == 'e' || in == 'E'))
     {
       item->valueint = i * (int) sign;
       item->type = aJson_Int;
@@ -250,7 +534,7 @@ aJsonStream::parseNumber(aJsonObject *item)
   //ok it seems to be a double
   else
     {
-      double n = (double) i;
+      double n = overflow ? big : (double) i;
       int scale = 0;
       int subscale = 0;
       char signsubscale = 1;
@@ -294,10 +578,100 @@ aJsonStream::parseNumber(aJsonObject *item)
   return 0;
 }
 
+// Keep the text of a number as it is, for aJson_RawNumbers. Only checks that
+// it really is a number and whether it is an int - integers too big for an
+// int count as floats, like parseNumber() reads them.
+int
+aJsonStream::parseRawNumber(aJsonObject *item)
+{
+  string_buffer *buffer = stringBufferCreate();
+  if (buffer == NULL)
+    {
+      return EOF; // memory fail
+    }
+  char type = aJson_Int;
+  unsigned int digits = 0;
+  int value = 0;
+  int in = this->getch();
+  if (in == '-')
+    {
+      stringBufferAdd((char) in, buffer);
+      in = this->getch();
+    }
+  for (; in >= '0' && in <= '9'; in = this->getch(), digits++)
+    {
+      if (digits == 1 && value == 0)
+        {
+          //no leading zeros
+          stringBufferFree(buffer);
+          return EOF;
+        }
+      if (type == aJson_Int && value > (INT_MAX - (in - '0')) / 10)
+        type = aJson_Float;
+      else if (type == aJson_Int)
+        value = (value * 10) + (in - '0');
+      stringBufferAdd((char) in, buffer);
+    }
+  if (digits && in == '.')
+    {
+      //the fraction needs digits too
+      type = aJson_Float;
+      digits = 0;
+      stringBufferAdd((char) in, buffer);
+      for (in = this->getch(); in >= '0' && in <= '9'; in = this->getch(), digits++)
+        {
+          stringBufferAdd((char) in, buffer);
+        }
+    }
+  if (digits && (in == 'e' || in == 'E'))
+    {
+      //and so does the exponent
+      type = aJson_Float;
+      digits = 0;
+      stringBufferAdd((char) in, buffer);
+      in = this->getch();
+      if (in == '+' || in == '-')
+        {
+          stringBufferAdd((char) in, buffer);
+          in = this->getch();
+        }
+      for (; in >= '0' && in <= '9'; in = this->getch(), digits++)
+        {
+          stringBufferAdd((char) in, buffer);
+        }
+    }
+  this->ungetch(in);
+  if (!digits)
+    {
+      stringBufferFree(buffer);
+      return EOF; // not a number
+    }
+  size_t length = buffer->string_length;
+  aJsonRaw *raw = (aJsonRaw*) aJsonMalloc(sizeof(aJsonRaw) + length + 1);
+  if (raw == NULL)
+    {
+      stringBufferFree(buffer);
+      return EOF; // memory fail
+    }
+  raw->converted = 0;
+  raw->text = (char*) (raw + 1);
+  memcpy(raw->text, buffer->string, length);
+  raw->text[length] = 0;
+  stringBufferFree(buffer);
+  item->type = type;
+  item->flags |= aJson_Raw;
+  item->valueraw = raw;
+  return 0;
+}
+
 // Render the number nicely from the given item into a string.
 int
 aJsonStream::printInt(aJsonObject *item)
 {
+  if (item != NULL && (item->flags & aJson_Raw))
+    {
+      return this->print(item->valueraw->text);
+    }
   if (item != NULL)
     {
       return this->print(item->valueint, DEC);
@@ -309,6 +683,10 @@ aJsonStream::printInt(aJsonObject *item)
 int
 aJsonStream::printFloat(aJsonObject *item)
 {
+  if (item != NULL && (item->flags & aJson_Raw))
+    {
+      return this->print(item->valueraw->text);
+    }
   if (item != NULL)
     {
       double d = item->valuefloat;
@@ -342,6 +720,242 @@ aJsonStream::printFloat(aJsonObject *item)
   return 0;
 }
 
+// Translate the character after a backslash, 0 if we do not understand it.
+static char
+aJsonUnescape(int in)
+{
+  switch (in)
+    {
+  case '\\':
+    return '\\';
+  case '\"':
+    return '\"';
+  case '/':
+    return '/';
+  case 'b':
+    return '\b';
+  case 'f':
+    return '\f';
+  case 'n':
+    return '\n';
+  case 'r':
+    return '\r';
+  case 't':
+    return '\t';
+  default:
+    //we do not understand it
+    return 0;
+    }
+}
+
+// What the next bytes of a UTF-8 sequence have to look like.
+typedef struct aJsonUtf8 {
+  unsigned char need; // continuation bytes still missing
+  unsigned char low, high; // the range of the next one
+} aJsonUtf8;
+
+// Check the next byte of a string, EOF if it is no valid UTF-8 there.
+static int
+aJsonCheckUtf8(aJsonUtf8 *state, int in)
+{
+  if (state->need)
+    {
+      if (in < state->low || in > state->high)
+        {
+          return EOF;
+        }
+      state->need--;
+      state->low = 0x80;
+      state->high = 0xBF;
+      return 0;
+    }
+  if (in < 0x80)
+    {
+      return 0;
+    }
+  state->low = 0x80;
+  state->high = 0xBF;
+  if (in < 0xC2)
+    {
+      return EOF; // a continuation byte or an overlong pair
+    }
+  else if (in < 0xE0)
+    {
+      state->need = 1;
+    }
+  else if (in < 0xF0)
+    {
+      state->need = 2;
+      //no overlong sequences and no surrogates
+      if (in == 0xE0)
+        state->low = 0xA0;
+      else if (in == 0xED)
+        state->high = 0x9F;
+    }
+  else if (in < 0xF5)
+    {
+      state->need = 3;
+      //nothing below 0x10000 or above 0x10FFFF
+      if (in == 0xF0)
+        state->low = 0x90;
+      else if (in == 0xF4)
+        state->high = 0x8F;
+    }
+  else
+    {
+      return EOF;
+    }
+  return 0;
+}
+
+// Put code as UTF-8 into out, return the number of bytes.
+static int
+aJsonPutUtf8(char *out, unsigned long code)
+{
+  if (code < 0x80)
+    {
+      out[0] = code;
+      return 1;
+    }
+  if (code < 0x800)
+    {
+      out[0] = 0xC0 | (code >> 6);
+      out[1] = 0x80 | (code & 0x3F);
+      return 2;
+    }
+  if (code < 0x10000)
+    {
+      out[0] = 0xE0 | (code >> 12);
+      out[1] = 0x80 | ((code >> 6) & 0x3F);
+      out[2] = 0x80 | (code & 0x3F);
+      return 3;
+    }
+  out[0] = 0xF0 | (code >> 18);
+  out[1] = 0x80 | ((code >> 12) & 0x3F);
+  out[2] = 0x80 | ((code >> 6) & 0x3F);
+  out[3] = 0x80 | (code & 0x3F);
+  return 4;
+}
+
+// Read the four hex digits of a \u escape.
+int
+aJsonStream::readHex(unsigned int *code)
+{
+  *code = 0;
+  for (char i = 0; i < 4; i++)
+    {
+      int in = this->getch();
+      if (in == EOF || !isxdigit(in))
+        {
+          return EOF;
+        }
+      *code = (*code << 4) | (isdigit(in) ? in - '0' : (in | 0x20) - 'a' + 10);
+    }
+  return 0;
+}
+
+// Read what follows a backslash and put it into out as UTF-8, at most 7
+// bytes. Returns their number or EOF if it is no escape. A surrogate that
+// is not part of a pair becomes U+FFFD, \u0000 is left out since a
+// cstring cannot hold it.
+int
+aJsonStream::readEscape(char *out)
+{
+  int in = this->getch();
+  unsigned int code;
+  if (in != 'u')
+    {
+      char ch = aJsonUnescape(in);
+      if (!ch)
+        {
+          return EOF;
+        }
+      out[0] = ch;
+      return 1;
+    }
+  if (this->readHex(&code) == EOF)
+    {
+      return EOF;
+    }
+  if (code == 0)
+    {
+      return 0;
+    }
+  if (code < 0xD800 || code >= 0xE000)
+    {
+      return aJsonPutUtf8(out, code);
+    }
+  int length = aJsonPutUtf8(out, 0xFFFD);
+  if (code >= 0xDC00)
+    {
+      return length; // a low surrogate on its own
+    }
+  in = this->getch();
+  if (in != '\\')
+    {
+      if (in != EOF)
+        {
+          this->ungetch(in);
+        }
+      return length;
+    }
+  in = this->getch();
+  if (in != 'u')
+    {
+      char ch = aJsonUnescape(in);
+      if (!ch)
+        {
+          return EOF;
+        }
+      out[length] = ch;
+      return length + 1;
+    }
+  unsigned int low;
+  if (this->readHex(&low) == EOF)
+    {
+      return EOF;
+    }
+  if (low >= 0xDC00 && low < 0xE000)
+    {
+      return aJsonPutUtf8(out,
+          0x10000 + ((unsigned long) (code - 0xD800) << 10) + (low - 0xDC00));
+    }
+  if (low == 0)
+    {
+      return length;
+    }
+  //two lone surrogates in a row or a surrogate before something else
+  return length + aJsonPutUtf8(out + length,
+      (low >= 0xD800 && low < 0xE000) ? 0xFFFD : low);
+}
+
+// The letter to put after a backslash for ch, 0 if there is none.
+static char
+aJsonEscape(char ch)
+{
+  switch (ch)
+    {
+  case '\\':
+    return '\\';
+  case '\"':
+    return '\"';
+  case '/':
+    return '/';
+  case '\b':
+    return 'b';
+  case '\f':
+    return 'f';
+  case '\n':
+    return 'n';
+  case '\r':
+    return 'r';
+  case '\t':
+    return 't';
+  default:
+    return 0;
+    }
+}
+
 // Parse the input text into an unescaped cstring, and populate item.
 int
 aJsonStream::parseString(aJsonObject *item)
@@ -366,51 +980,34 @@ aJsonStream::parseString(aJsonObject *item)
       stringBufferFree(buffer);
       return EOF;
     }
+  aJsonUtf8 utf8 = { 0, 0x80, 0xBF };
   while (in != EOF)
     {
       while (in != '\"' && in >= 32)
         {
           if (in != '\\')
             {
+              //plain ASCII is all most strings hold
+              if ((in >= 0x80 || utf8.need)
+                  && aJsonCheckUtf8(&utf8, in) == EOF)
+                {
+                  stringBufferFree(buffer);
+                  return EOF;
+                }
               stringBufferAdd((char) in, buffer);
             }
           else
             {
-              in = this->getch();
-              if (in == EOF)
+              char decoded[7];
+              int length = utf8.need ? EOF : this->readEscape(decoded);
+              if (length == EOF)
                 {
                   stringBufferFree(buffer);
                   return EOF;
                 }
-              switch (in)
+              for (int i = 0; i < length; i++)
                 {
-              case '\\':
-                stringBufferAdd('\\', buffer);
-                break;
-              case '\"':
-                stringBufferAdd('\"', buffer);
-                break;
-              case '/':
-                stringBufferAdd('/', buffer);
-                break;
-              case 'b':
-                stringBufferAdd('\b', buffer);
-                break;
-              case 'f':
-                stringBufferAdd('\f', buffer);
-                break;
-              case 'n':
-                stringBufferAdd('\n', buffer);
-                break;
-              case 'r':
-                stringBufferAdd('\r', buffer);
-                break;
-              case 't':
-                stringBufferAdd('\t', buffer);
-                break;
-              default:
-                //we do not understand it so we skip it
-                break;
+                  stringBufferAdd(decoded[i], buffer);
                 }
             }
           in = this->getch();
@@ -420,6 +1017,12 @@ aJsonStream::parseString(aJsonObject *item)
               return EOF;
             }
         }
+      if (utf8.need)
+        {
+          //the string ends in the middle of a character
+          stringBufferFree(buffer);
+          return EOF;
+        }
       //the string ends here
       item->valuestring = stringBufferToString(buffer);
       return 0;
@@ -440,41 +1043,28 @@ aJsonStream::printStringPtr(const char *str)
         {
           if ((unsigned char) *ptr > 31 && *ptr != '\"' && *ptr != '\\')
             {
-	      this->print(*ptr);
-              ptr++;
+              //write everything up to the next escape at once
+              char* run = ptr;
+              while ((unsigned char) *ptr > 31 && *ptr != '\"' && *ptr != '\\')
+                ptr++;
+              this->write((const uint8_t*) run, ptr - run);
             }
           else
             {
 	      this->print('\\');
-              switch (*ptr++)
+              char letter = aJsonEscape(*ptr);
+              if (letter)
                 {
-              case '\\':
-		this->print('\\');
-                break;
-              case '\"':
-		this->print('\"');
-                break;
-              case '/':
-		this->print('/');
-                break;
-              case '\b':
-		this->print('b');
-                break;
-              case '\f':
-		this->print('f');
-                break;
-              case '\n':
-		this->print('n');
-                break;
-              case '\r':
-		this->print('r');
-                break;
-              case '\t':
-		this->print('t');
-                break;
-              default:
-                break; // eviscerate with prejudice.
+		  this->print(letter);
+                }
+              else
+                {
+                  //other control characters go as \u00XX
+                  this->print("u00");
+                  this->print("0123456789abcdef"[(*ptr >> 4) & 0xF]);
+                  this->print("0123456789abcdef"[*ptr & 0xF]);
                 }
+              ptr++;
             }
 
         }
@@ -522,15 +1112,148 @@ aJsonStream::flush()
 }
 
 
+// Read a string without allocating, keeping what fits into buffer.
+int
+aJsonStream::readString(char *buffer, size_t len)
+{
+  int in = this->getch();
+  if (in != '\"')
+    {
+      return EOF; // not a string!
+    }
+  int length = 0;
+  aJsonUtf8 utf8 = { 0, 0x80, 0xBF };
+  in = this->getch();
+  while (in != '\"')
+    {
+      if (in == EOF || in < 32)
+        {
+          return EOF;
+        }
+      char decoded[7];
+      int count = 1;
+      if (in == '\\')
+        {
+          count = utf8.need ? EOF : this->readEscape(decoded);
+        }
+      else
+        {
+          if ((in >= 0x80 || utf8.need) && aJsonCheckUtf8(&utf8, in) == EOF)
+            {
+              return EOF;
+            }
+          decoded[0] = (char) in;
+        }
+      if (count == EOF)
+        {
+          return EOF;
+        }
+      for (int i = 0; i < count; i++)
+        {
+          if ((size_t) length + 1 < len)
+            {
+              buffer[length] = decoded[i];
+            }
+          length++;
+        }
+      in = this->getch();
+    }
+  if (utf8.need)
+    {
+      return EOF;
+    }
+  if (len > 0)
+    {
+      buffer[(size_t) length < len ? length : len - 1] = 0;
+    }
+  return length;
+}
+
+// Skip a value by just matching brackets and quotes. This is all we need to
+// find where it ends, so it is faster than a real parse and needs no memory.
+int
+aJsonStream::skipValue()
+{
+  if (this->skip() == EOF)
+    {
+      return EOF;
+    }
+  int depth = 0;
+  do
+    {
+      int in = this->getch();
+      switch (in)
+        {
+      case EOF:
+        return EOF;
+      case '\"':
+        in = this->getch();
+        while (in != '\"')
+          {
+            if (in == EOF)
+              {
+                return EOF;
+              }
+            if (in == '\\')
+              {
+                this->getch();
+              }
+            in = this->getch();
+          }
+        break;
+      case '{':
+      case '[':
+        depth++;
+        break;
+      case '}':
+      case ']':
+        if (--depth < 0)
+          {
+            return EOF; // closing something we did not open
+          }
+        break;
+      default:
+        if (depth == 0)
+          {
+            //a number or literal, it ends at the next separator
+            while (in != EOF && in > 32 && in != ',' && in != '}' && in != ']')
+              {
+                in = this->getch();
+              }
+            if (in != EOF)
+              {
+                this->ungetch(in);
+              }
+            return 0;
+          }
+        break;
+        }
+    }
+  while (depth > 0);
+  return 0;
+}
+
 // Parse an object - create a new root, and populate.
 aJsonObject*
 aJsonClass::parse(char *value)
 {
+  if (aJsonActiveCache != NULL)
+    {
+      return aJsonActiveCache->parse(value);
+    }
   aJsonStringStream stringStream(value, NULL);
   aJsonObject* result = parse(&stringStream);
   return result;
 }
 
+aJsonObject*
+aJsonClass::parse(char *value, unsigned char options)
+{
+  aJsonStringStream stringStream(value, NULL);
+  stringStream.setOptions(options);
+  return parse(&stringStream);
+}
+
 // Parse an object - create a new root, and populate.
 aJsonObject*
 aJsonClass::parse(aJsonStream* stream)
@@ -546,6 +1269,7 @@ aJsonClass::parse(aJsonStream* stream, char** filter)
     {
       return NULL;
     }
+  aJsonAllocatorScope scope(stream->getAllocator());
   aJsonObject *c = newItem();
   if (!c)
     return NULL; /* memory fail */
@@ -559,6 +1283,185 @@ aJsonClass::parse(aJsonStream* stream, char** filter)
   return c;
 }
 
+// Parse only the parts of the stream the paths lead to.
+aJsonObject*
+aJsonClass::project(aJsonStream* stream, aJsonPath **paths, unsigned char count,
+    aJsonObject **values, bool stop)
+{
+  if (stream == NULL || paths == NULL)
+    {
+      return NULL;
+    }
+  aJsonAllocatorScope scope(stream->getAllocator());
+  aJsonProjection projection;
+  projection.paths = paths;
+  projection.values = values;
+  projection.count = count;
+  projection.pending = 0;
+  projection.stop = stop;
+  bool whole = false;
+  for (unsigned char i = 0; i < count; i++)
+    {
+      if (values)
+        values[i] = NULL;
+      if (paths[i] == NULL)
+        continue;
+      paths[i]->step = 0;
+      projection.pending++;
+      if (paths[i]->count == 0)
+        whole = true;
+    }
+  if (whole)
+    {
+      //somebody wants the root itself, so there is nothing to skip
+      aJsonObject *root = parse(stream);
+      if (root && values)
+        {
+          for (unsigned char i = 0; i < count; i++)
+            values[i] = paths[i] ? walkPath(root, paths[i], 0, paths[i]->count) : NULL;
+        }
+      return root;
+    }
+  aJsonObject *root = newItem();
+  if (!root)
+    return NULL; /* memory fail */
+  stream->skip();
+  if (stream->parseProjection(root, &projection, 0) == EOF)
+    {
+      deleteItem(root);
+      if (values)
+        {
+          for (unsigned char i = 0; i < count; i++)
+            values[i] = NULL;
+        }
+      return NULL;
+    }
+  return root;
+}
+
+// Find the elements of a top level array by its brackets, commas and quotes alone.
+int
+aJsonClass::splitArray(const char *json, size_t length, aJsonText *elements,
+    unsigned char count)
+{
+  if (json == NULL)
+    {
+      return EOF;
+    }
+  size_t i = 0;
+  while (i < length && (unsigned char) json[i] <= 32)
+    i++;
+  if (i == length || json[i] != '[')
+    {
+      return EOF;
+    }
+  int found = 0;
+  unsigned char depth = 0;
+  bool in_string = false, escaped = false;
+  const char *start = NULL; // the element being looked at
+  const char *end = NULL; // after its last character that is not whitespace
+  for (i++; i < length; i++)
+    {
+      char ch = json[i];
+      if (in_string)
+        {
+          if (escaped)
+            escaped = false;
+          else if (ch == '\\')
+            escaped = true;
+          else if (ch == '\"')
+            in_string = false;
+          end = json + i + 1;
+          continue;
+        }
+      if ((unsigned char) ch <= 32)
+        {
+          continue;
+        }
+      if (depth == 0 && (ch == ',' || ch == ']'))
+        {
+          if (start == NULL)
+            {
+              //only [] may have nothing between the brackets
+              return (ch == ']' && found == 0) ? 0 : EOF;
+            }
+          if (found == INT_MAX)
+            {
+              return EOF;
+            }
+          if (found < count)
+            {
+              elements[found].start = start;
+              elements[found].length = end - start;
+            }
+          found++;
+          if (ch == ']')
+            {
+              return found;
+            }
+          start = NULL;
+          continue;
+        }
+      if (start == NULL)
+        start = json + i;
+      end = json + i + 1;
+      if (ch == '\"')
+        {
+          in_string = true;
+        }
+      else if (ch == '{' || ch == '[')
+        {
+          if (depth == 255)
+            return EOF;
+          depth++;
+        }
+      else if (ch == '}' || ch == ']')
+        {
+          if (depth == 0)
+            return EOF;
+          depth--;
+        }
+    }
+  return EOF;
+}
+
+// Parse elements one by one, each from its own piece of the input.
+aJsonObject*
+aJsonClass::parseElements(const aJsonText *elements, unsigned char count,
+    const aJsonAllocator *allocator)
+{
+  aJsonAllocatorScope scope(allocator);
+  aJsonObject *array = newItem();
+  if (!array)
+    return NULL; /* memory fail */
+  array->type = aJson_Array;
+  aJsonObject *last = NULL;
+  for (unsigned char i = 0; i < count; i++)
+    {
+      aJsonStringStream stream((char*) elements[i].start, NULL, 0,
+          elements[i].length);
+      stream.setAllocator(allocator);
+      aJsonObject *item = parse(&stream);
+      if (item && stream.skip() != EOF)
+        {
+          //something after the value, e.g. a missing comma
+          deleteItem(item);
+          item = NULL;
+        }
+      if (!item)
+        {
+          deleteItem(array);
+          return NULL;
+        }
+      if (last)
+        suffixObject(last, item);
+      else
+        array->child = item;
+      last = item;
+    }
+  return array;
+}
+
 // Render a aJsonObject item/entity/structure to text.
 int
 aJsonClass::print(aJsonObject* item, aJsonStream* stream)
@@ -566,16 +1469,65 @@ aJsonClass::print(aJsonObject* item, aJsonStream* stream)
   return stream->printValue(item);
 }
 
+// Print to nowhere, just counting.
+size_t
+aJsonClass::printedLength(aJsonObject *item)
+{
+  aJsonCountingStream counter;
+  print(item, &counter);
+  return counter.count;
+}
+
+// Print into a buffer of the caller.
+size_t
+aJsonClass::print(aJsonObject *item, char *buffer, size_t size)
+{
+  if (buffer && size)
+    {
+      buffer[0] = 0;
+    }
+  aJsonStringStream stringStream(NULL, buffer, size);
+  print(item, &stringStream);
+  return (buffer && size ? strlen(buffer) : 0) + stringStream.truncated();
+}
+
+// Copy a value from one stream to another, checking it on the way.
+int
+aJsonClass::transcode(aJsonStream* in, aJsonStream* out, unsigned char indent,
+    aJsonError *error)
+{
+  if (in == NULL)
+    {
+      return EOF;
+    }
+  return in->scanValue(out, indent, error);
+}
+
+// Check a value without allocating anything.
+int
+aJsonClass::validate(aJsonStream* stream, aJsonError *error)
+{
+  if (stream == NULL)
+    {
+      return EOF;
+    }
+  return stream->scanDocument(error);
+}
+
 char*
 aJsonClass::print(aJsonObject* item)
 {
+  /* The buffer is freed by the caller with free(), so it is not ours to count. */
   char* outBuf = (char*) malloc(PRINT_BUFFER_LEN); /* XXX: Dynamic size. */
   if (outBuf == NULL)
     {
       return NULL;
     }
+  outBuf[0] = 0;
   aJsonStringStream stringStream(NULL, outBuf, PRINT_BUFFER_LEN);
   print(item, &stringStream);
+  aJsonCountPrintBuffer(PRINT_BUFFER_LEN - strlen(outBuf) - 1,
+      stringStream.truncated());
   return outBuf;
 }
 
@@ -600,6 +1552,10 @@ aJsonStream::parseValue(aJsonObject *item, char** filter)
     }
   else if (in == '-' || (in >= '0' && in <= '9'))
     {
+      if (this->options & aJson_RawNumbers)
+        {
+          return this->parseRawNumber(item);
+        }
       return this->parseNumber(item);
     }
   else if (in == '[')
@@ -708,6 +1664,103 @@ aJsonStream::printValue(aJsonObject *item)
   return result;
 }
 
+// Whether the member a at index ai comes after b at bi in sorted order.
+static bool
+aJsonSortsAfter(aJsonObject *a, unsigned int ai, aJsonObject *b,
+    unsigned int bi)
+{
+  int order = strcmp(a->name ? a->name : "", b->name ? b->name : "");
+  return order > 0 || (order == 0 && ai > bi);
+}
+
+// Render a value to text the same way every time.
+int
+aJsonStream::printCanonical(aJsonObject *item)
+{
+  if (item == NULL)
+    {
+      //nothing to do
+      return 0;
+    }
+  aJsonObject value = *item;
+  if ((value.type == aJson_Int || value.type == aJson_Float)
+      && (value.flags & aJson_Raw))
+    {
+      //integers too big for an int are already canonical, a double
+      //would only mangle them
+      if (value.type == aJson_Float && !strpbrk(value.valueraw->text, ".eE"))
+        return this->print(value.valueraw->text);
+      value.flags = 0;
+      if (value.type == aJson_Int)
+        value.valueint = aJson.getInt(item);
+      else
+        value.valuefloat = aJson.getFloat(item);
+    }
+  if (value.type != aJson_Array && value.type != aJson_Object)
+    {
+      return this->printValue(&value);
+    }
+  if (aJsonClass::materialize(item) == EOF)
+    {
+      return EOF;
+    }
+  if (item->flags & aJson_Packed)
+    {
+      //packed numbers are never raw
+      return this->printArray(item);
+    }
+  if (value.type == aJson_Array)
+    {
+      if (this->print('[') == EOF)
+        {
+          return EOF;
+        }
+      for (aJsonObject *child = item->child; child; child = child->next)
+        {
+          if ((child != item->child && this->print(',') == EOF)
+              || this->printCanonical(child) == EOF)
+            {
+              return EOF;
+            }
+        }
+      return (this->print(']') == EOF) ? EOF : 0;
+    }
+  if (this->print('{') == EOF)
+    {
+      return EOF;
+    }
+  //pick the members in order, each time the smallest after the last one
+  aJsonObject *last = NULL;
+  unsigned int last_index = 0;
+  for (;;)
+    {
+      aJsonObject *next = NULL;
+      unsigned int next_index = 0, index = 0;
+      for (aJsonObject *child = item->child; child; child = child->next, index++)
+        {
+          if ((last == NULL || aJsonSortsAfter(child, index, last, last_index))
+              && (next == NULL || aJsonSortsAfter(next, next_index, child, index)))
+            {
+              next = child;
+              next_index = index;
+            }
+        }
+      if (next == NULL)
+        {
+          break;
+        }
+      if ((last != NULL && this->print(',') == EOF)
+          || this->printStringPtr(next->name) == EOF || this->print(':') == EOF
+          || this->printCanonical(next) == EOF)
+        {
+          return EOF;
+        }
+      last = next;
+      last_index = next_index;
+    }
+  return (this->print('}') == EOF) ? EOF : 0;
+}
+
 // Build an array from input text.
 int
 aJsonStream::parseArray(aJsonObject *item, char** filter)
@@ -728,8 +1781,27 @@ aJsonStream::parseArray(aJsonObject *item, char** filter)
     }
   //now put back the last character
   this->ungetch(in);
-  aJsonObject *child;
-  char first = -1;
+  aJsonObject *child = NULL;
+  if ((this->options & aJson_PackNumbers) && (in == '-' || (in >= '0' && in
+      <= '9')))
+    {
+      if (this->parsePacked(item, &in) == EOF)
+        {
+          return EOF;
+        }
+      if (in != ',')
+        {
+          return (in == ']') ? 0 : EOF;
+        }
+      //something else than a number follows, go on with a plain list
+      if (aJsonClass::unpack(item) == EOF)
+        {
+          return EOF;
+        }
+      for (child = item->child; child->next; child = child->next)
+        ;
+    }
+  char first = child ? 0 : -1;
   while ((first) || (in == ','))
     {
       aJsonObject *new_item = aJsonClass::newItem();
@@ -749,7 +1821,7 @@ aJsonStream::parseArray(aJsonObject *item, char** filter)
         }
       child = new_item;
       this->skip();
-      if (this->parseValue(child, filter))
+      if (this->parseMember(child, filter))
         {
           return EOF;
         }
@@ -766,45 +1838,204 @@ aJsonStream::parseArray(aJsonObject *item, char** filter)
     }
 }
 
-// Render an array to text
+// Collect the numbers at the start of an array into a packed array. Stops at
+// the end of the array, or with in set to ',' in front of the first value that
+// is no number or does not fit anymore. A number of the other type than the
+// ones before it turns the array into a plain list with that number appended,
+// so that ints stay ints and floats floats.
 int
-aJsonStream::printArray(aJsonObject *item)
+aJsonStream::parsePacked(aJsonObject *item, int *in)
 {
-  if (item == NULL)
-    {
-      //nothing to do
-      return 0;
-    }
-  aJsonObject *child = item->child;
-  if (this->print('[') == EOF)
-    {
-      return EOF;
-    }
-  while (child)
+  aJsonPacked *packed = NULL;
+  do
     {
-      if (this->printValue(child) == EOF)
+      this->skip();
+      int next = this->getch();
+      this->ungetch(next);
+      if (packed && (packed->count == 255 || !(next == '-' || (next >= '0'
+          && next <= '9'))))
         {
+          break;
+        }
+      aJsonObject value;
+      if (this->parseNumber(&value) == EOF)
+        {
+          aJsonFreePacked(packed);
           return EOF;
         }
-      child = child->next;
-      if (child)
+      if (packed && packed->type != value.type)
         {
-          if (this->print(',') == EOF)
+          item->valuepacked = packed;
+          item->flags |= aJson_Packed;
+          return this->unpackMixed(item, &value, in);
+        }
+      char type = value.type;
+      if (!packed || packed->count == packed->capacity)
+        {
+          unsigned char capacity = 4;
+          if (packed)
+            capacity = (packed->capacity < 128) ? packed->capacity * 2 : 255;
+          aJsonPacked *grown = aJsonCopyPacked(packed, type, capacity);
+          aJsonFreePacked(packed);
+          if (!grown)
             {
-              return EOF;
+              return EOF; // memory fail
             }
+          packed = grown;
         }
+      if (type == aJson_Int)
+        packed->ints[packed->count++] = value.valueint;
+      else
+        packed->floats[packed->count++] = value.valuefloat;
+      this->skip();
+      *in = this->getch();
     }
-  if (this->print(']') == EOF)
+  while (*in == ',');
+  if (packed->count < packed->capacity)
     {
-      return EOF;
+      //give back what we did not need
+      aJsonPacked *fitted = aJsonCopyPacked(packed, packed->type, packed->count);
+      if (fitted)
+        {
+          aJsonFreePacked(packed);
+          packed = fitted;
+        }
     }
+  item->valuepacked = packed;
+  item->flags |= aJson_Packed;
   return 0;
 }
 
-// Build an object from the text.
+// Turn the packed numbers parsed so far back into a list and append value,
+// the first number of the other type, then read on to the next separator.
 int
-aJsonStream::parseObject(aJsonObject *item, char** filter)
+aJsonStream::unpackMixed(aJsonObject *item, aJsonObject *value, int *in)
+{
+  if (aJsonClass::unpack(item) == EOF)
+    {
+      return EOF;
+    }
+  aJsonObject *last = item->child;
+  while (last->next)
+    {
+      last = last->next;
+    }
+  aJsonObject *number = aJsonClass::newItem();
+  if (number == NULL)
+    {
+      return EOF; // memory fail
+    }
+  number->type = value->type;
+  if (value->type == aJson_Int)
+    number->valueint = value->valueint;
+  else
+    number->valuefloat = value->valuefloat;
+  last->next = number;
+  number->prev = last;
+  this->skip();
+  *in = this->getch();
+  return 0;
+}
+
+// Parse the value of an array element or object member. With aJson_LazyParse
+// objects and arrays are just skipped and remembered.
+int
+aJsonStream::parseMember(aJsonObject *item, char** filter)
+{
+  if ((this->options & aJson_LazyParse) && this->position())
+    {
+      int in = this->getch();
+      this->ungetch(in);
+      if (in == '{' || in == '[')
+        {
+          return this->parseLazy(item, in);
+        }
+    }
+  return this->parseValue(item, filter);
+}
+
+// Remember where the object or array starting with in is, so that
+// aJsonClass::materialize() can parse it later.
+int
+aJsonStream::parseLazy(aJsonObject *item, int in)
+{
+  const char *start = this->position();
+  if (this->skipValue() == EOF)
+    {
+      return EOF;
+    }
+  item->type = (in == '{') ? aJson_Object : aJson_Array;
+  item->flags |= aJson_Lazy | (this->options << aJson_LazyShift);
+  item->valuetext.start = start;
+  item->valuetext.length = this->position() - start;
+  return 0;
+}
+
+// Render an array to text
+int
+aJsonStream::printArray(aJsonObject *item)
+{
+  if (item == NULL)
+    {
+      //nothing to do
+      return 0;
+    }
+  if (aJsonClass::materialize(item) == EOF)
+    {
+      return EOF;
+    }
+  aJsonObject *child = item->child;
+  if (this->print('[') == EOF)
+    {
+      return EOF;
+    }
+  if (item->flags & aJson_Packed)
+    {
+      aJsonPacked *packed = item->valuepacked;
+      aJsonObject value;
+      value.type = packed->type;
+      value.flags = 0;
+      for (unsigned char i = 0; i < packed->count; i++)
+        {
+          if (i && this->print(',') == EOF)
+            {
+              return EOF;
+            }
+          if (packed->type == aJson_Int)
+            value.valueint = packed->ints[i];
+          else
+            value.valuefloat = packed->floats[i];
+          if (this->printValue(&value) == EOF)
+            {
+              return EOF;
+            }
+        }
+    }
+  while (child)
+    {
+      if (this->printValue(child) == EOF)
+        {
+          return EOF;
+        }
+      child = child->next;
+      if (child)
+        {
+          if (this->print(',') == EOF)
+            {
+              return EOF;
+            }
+        }
+    }
+  if (this->print(']') == EOF)
+    {
+      return EOF;
+    }
+  return 0;
+}
+
+// Build an object from the text.
+int
+aJsonStream::parseObject(aJsonObject *item, char** filter)
 {
   int in = this->getch();
   if (in != '{')
@@ -859,7 +2090,7 @@ aJsonStream::parseObject(aJsonObject *item, char** filter)
         }
       // skip any spacing, get the value.
       this->skip();
-      if (this->parseValue(child, filter) == EOF)
+      if (this->parseMember(child, filter) == EOF)
         {
           return EOF;
         }
@@ -877,148 +2108,2166 @@ aJsonStream::parseObject(aJsonObject *item, char** filter)
     }
 }
 
-// Render an object to text.
+// Does a key read by readString() into a buffer of len bytes match the segment?
+// Keys too long for the buffer were cut off, so they never match.
+static bool
+aJsonKeyMatches(const aJsonPathSegment *segment, bool exact, const char *key,
+    int length, size_t len)
+{
+  if (length != segment->length || (size_t) length >= len)
+    return false;
+  return exact ? !strcmp(key, segment->key) : !strcasecmp(key, segment->key);
+}
+
+// Parse the value at the current position of the projection. Paths whose step
+// equals depth are the ones still alive here, each child either completes some
+// of them (and is parsed for real), leads further down for some (and we recurse)
+// or is skipped.
 int
-aJsonStream::printObject(aJsonObject *item)
+aJsonStream::parseProjection(aJsonObject *item, aJsonProjection *projection,
+    unsigned char depth)
 {
-  if (item == NULL)
+  aJsonPath **paths = projection->paths;
+  unsigned char count = projection->count;
+  unsigned char i;
+  if (this->skip() == EOF)
     {
-      //nothing to do
-      return 0;
+      return EOF;
     }
-  aJsonObject *child = item->child;
-  if (this->print('{') == EOF)
+  int in = this->getch();
+  char close = 0;
+  if (in == '{')
     {
-      return EOF;
+      item->type = aJson_Object;
+      close = '}';
     }
-  while (child)
+  else if (in == '[')
     {
-      if (this->printStringPtr(child->name) == EOF)
+      item->type = aJson_Array;
+      close = ']';
+    }
+  else
+    {
+      //the paths want to go deeper, but this is no container
+      this->ungetch(in);
+      if (this->skipValue() == EOF)
         {
           return EOF;
         }
-      if (this->print(':') == EOF)
+    }
+  if (close)
+    {
+      this->skip();
+      in = this->getch();
+      if (in == EOF)
         {
           return EOF;
         }
-      if (this->printValue(child) == EOF)
+      if (in != close)
         {
-          return EOF;
+          this->ungetch(in);
+          in = ',';
         }
-      child = child->next;
-      if (child)
+    }
+  char key[PROJECTION_KEY_LEN];
+  int key_length = 0;
+  unsigned char index = 0;
+  aJsonObject *last = NULL;
+  while (close && in == ',')
+    {
+      this->skip();
+      if (close == '}')
         {
-          if (this->print(',') == EOF)
+          key_length = this->readString(key, sizeof(key));
+          if (key_length == EOF)
+            {
+              return EOF;
+            }
+          this->skip();
+          if (this->getch() != ':')
+            {
+              return EOF; // fail!
+            }
+        }
+      //find out what the paths alive here think of this child
+      bool whole = false, deeper = false;
+      for (i = 0; i < count; i++)
+        {
+          aJsonPath *path = paths[i];
+          if (!path || path->step != depth)
+            continue;
+          const aJsonPathSegment *segment = &path->segments[depth];
+          if (close == '}' ? aJsonKeyMatches(segment, path->exact, key,
+              key_length, sizeof(key)) : segment->index == index)
+            {
+              path->step = depth + 1;
+              if (path->count == depth + 1)
+                whole = true;
+              else
+                deeper = true;
+            }
+        }
+      if (!whole && !deeper)
+        {
+          if (this->skipValue() == EOF)
+            {
+              return EOF;
+            }
+        }
+      else
+        {
+          aJsonObject *child = aJsonClass::newItem();
+          if (child == NULL)
+            {
+              return EOF; // memory fail
+            }
+          if (last)
+            {
+              last->next = child;
+              child->prev = last;
+            }
+          else
+            {
+              item->child = child;
+            }
+          if (close == '}')
+            {
+              child->name = aJsonStrdup(key);
+              if (child->name == NULL)
+                {
+                  return EOF;
+                }
+            }
+          int result = whole ? this->parseValue(child, NULL)
+              : this->parseProjection(child, projection, depth + 1);
+          if (result == EOF)
             {
               return EOF;
             }
+          //everybody who came in here is done - found or not
+          for (i = 0; i < count; i++)
+            {
+              aJsonPath *path = paths[i];
+              if (!path || path->step <= depth || path->step == PROJECTION_DONE)
+                continue;
+              if (projection->values)
+                {
+                  projection->values[i] = aJsonClass::walkPath(child, path, depth + 1,
+                      path->count);
+                }
+              path->step = PROJECTION_DONE;
+              projection->pending--;
+            }
+          if (!whole && child->child == NULL)
+            {
+              //nothing of interest down there
+              if (last)
+                last->next = NULL;
+              else
+                item->child = NULL;
+              aJson.deleteItem(child);
+            }
+          else
+            {
+              last = child;
+            }
+          if (projection->stop && projection->pending == 0)
+            {
+              return 0;
+            }
         }
+      index++;
+      this->skip();
+      in = this->getch();
     }
-  if (this->print('}') == EOF)
+  if (close && in != close)
     {
-      return EOF;
+      return EOF; // malformed.
+    }
+  //the rest of the paths alive here do not exist
+  for (i = 0; i < count; i++)
+    {
+      if (paths[i] && paths[i]->step == depth)
+        {
+          paths[i]->step = PROJECTION_DONE;
+          projection->pending--;
+        }
     }
   return 0;
 }
 
-// Get Array size/item / object item.
-unsigned char
-aJsonClass::getArraySize(aJsonObject *array)
-{
-  aJsonObject *c = array->child;
-  unsigned char i = 0;
-  while (c)
-    i++, c = c->next;
-  return i;
-}
-aJsonObject*
-aJsonClass::getArrayItem(aJsonObject *array, unsigned char item)
-{
-  aJsonObject *c = array->child;
-  while (c && item > 0)
-    item--, c = c->next;
-  return c;
-}
-aJsonObject*
-aJsonClass::getObjectItem(aJsonObject *object, const char *string)
-{
-  aJsonObject *c = object->child;
-  while (c && strcasecmp(c->name, string))
-    c = c->next;
-  return c;
-}
-
-// Utility for array list handling.
-void
-aJsonClass::suffixObject(aJsonObject *prev, aJsonObject *item)
-{
-  prev->next = item;
-  item->prev = prev;
-}
-// Utility for handling references.
-aJsonObject*
-aJsonClass::createReference(aJsonObject *item)
-{
-  aJsonObject *ref = newItem();
-  if (!ref)
-    return 0;
-  memcpy(ref, item, sizeof(aJsonObject));
-  ref->name = 0;
-  ref->type |= aJson_IsReference;
-  ref->next = ref->prev = 0;
-  return ref;
-}
-
-// Add item to array/object.
-void
-aJsonClass::addItemToArray(aJsonObject *array, aJsonObject *item)
+// Merge the patch object we are reading into target. Every member is handled
+// as soon as it is read, so at no time more than a single value is in memory.
+int
+aJsonStream::parseMergePatch(aJsonObject *target)
 {
-  aJsonObject *c = array->child;
-  if (!item)
-    return;
-  if (!c)
+  aJsonObject value;
+  memset(&value, 0, sizeof(value));
+  if (this->skip() == EOF)
     {
-      array->child = item;
+      return EOF;
     }
-  else
+  int in = this->getch();
+  this->ungetch(in);
+  if (in != '{')
     {
-      while (c && c->next)
-        c = c->next;
-      suffixObject(c, item);
+      //anything but an object simply replaces the target
+      if (this->parseValue(&value, NULL) == EOF)
+        {
+          aJson.deleteValue(&value);
+          return EOF;
+        }
+      aJsonSwapValues(target, &value);
+      aJson.deleteValue(&value);
+      return 0;
     }
-}
-void
-aJsonClass::addItemToObject(aJsonObject *object, const char *string,
-    aJsonObject *item)
-{
-  if (!item)
-    return;
-  if (item->name)
-    free(item->name);
-  item->name = strdup(string);
-  addItemToArray(object, item);
-}
-void
-aJsonClass::addItemReferenceToArray(aJsonObject *array, aJsonObject *item)
-{
-  addItemToArray(array, createReference(item));
-}
-void
-aJsonClass::addItemReferenceToObject(aJsonObject *object, const char *string,
-    aJsonObject *item)
-{
-  addItemToObject(object, string, createReference(item));
-}
-
-aJsonObject*
-aJsonClass::detachItemFromArray(aJsonObject *array, unsigned char which)
-{
-  aJsonObject *c = array->child;
-  while (c && which > 0)
-    c = c->next, which--;
-  if (!c)
-    return 0;
-  if (c->prev)
+  if (target->type != aJson_Object)
+    {
+      aJson.deleteValue(target);
+      target->type = aJson_Object;
+    }
+  if (aJson.expand(target) == EOF)
+    {
+      return EOF;
+    }
+  this->getch();
+  this->skip();
+  in = this->getch();
+  if (in == '}')
+    {
+      return 0; // empty patch
+    }
+  this->ungetch(in);
+  do
+    {
+      //parse the key like parseObject does, we may need it as name
+      this->skip();
+      if (this->parseString(&value) == EOF)
+        {
+          aJson.deleteValue(&value);
+          return EOF;
+        }
+      char *key = value.valuestring;
+      value.valuestring = NULL;
+      this->skip();
+      if (this->getch() != ':')
+        {
+          aJsonFreeString(key);
+          return EOF;
+        }
+      this->skip();
+      in = this->getch();
+      this->ungetch(in);
+      //patch keys mind case (RFC 7386)
+      aJsonObject *t = aJsonFindMember(target, key);
+      int result = 0;
+      if (in == '{')
+        {
+          if (!t)
+            {
+              t = aJsonClass::newItem();
+              if (!t)
+                {
+                  aJsonFreeString(key);
+                  return EOF; // memory fail
+                }
+              t->type = aJson_Object;
+              t->name = key;
+              key = NULL;
+              if (aJson.addItemToArray(target, t) == EOF)
+                {
+                  aJson.deleteItem(t);
+                  return EOF;
+                }
+            }
+          result = this->parseMergePatch(t);
+        }
+      else if (t)
+        {
+          //keep the node, just take over the new value - or drop it on null
+          result = this->parseValue(&value, NULL);
+          if (result != EOF && value.type == aJson_NULL)
+            {
+              aJsonUnlink(target, t);
+              aJson.deleteItem(t);
+            }
+          else if (result != EOF)
+            aJsonSwapValues(t, &value);
+          aJson.deleteValue(&value);
+        }
+      else
+        {
+          t = aJsonClass::newItem();
+          if (!t)
+            {
+              aJsonFreeString(key);
+              return EOF; // memory fail
+            }
+          result = this->parseValue(t, NULL);
+          if (result == EOF || t->type == aJson_NULL)
+            {
+              aJson.deleteItem(t);
+            }
+          else
+            {
+              t->name = key;
+              key = NULL;
+              result = aJson.addItemToArray(target, t);
+              if (result == EOF)
+                aJson.deleteItem(t);
+            }
+        }
+      aJsonFreeString(key);
+      if (result == EOF)
+        {
+          return EOF;
+        }
+      this->skip();
+      in = this->getch();
+    }
+  while (in == ',');
+  return in == '}' ? 0 : EOF;
+}
+
+// Write a character to out, if there is an out.
+static void
+aJsonEmit(aJsonStream *out, char ch)
+{
+  if (out)
+    {
+      out->print(ch);
+    }
+}
+
+// Start a new line indented for depth.
+static void
+aJsonEmitNewline(aJsonStream *out, unsigned char indent, unsigned char depth)
+{
+  if (out && indent)
+    {
+      out->print('\n');
+      for (unsigned int i = 0; i < (unsigned int) indent * depth; i++)
+        {
+          out->print(' ');
+        }
+    }
+}
+
+// Note where and why scanning failed. in is the offending character, which
+// has been read already, or EOF. Until now error->offset held where we started.
+int
+aJsonStream::scanError(aJsonError *error, char reason, int in)
+{
+  if (error)
+    {
+      error->reason = (in == EOF) ? aJson_ErrorEnd : reason;
+      error->offset = this->consumed - ((in == EOF) ? 0 : 1) - error->offset;
+    }
+  return EOF;
+}
+
+// Check a string and copy it verbatim, escapes included.
+int
+aJsonStream::scanString(aJsonStream *out, aJsonError *error)
+{
+  int in = this->getch();
+  if (in != '\"')
+    {
+      return this->scanError(error, aJson_ErrorUnexpected, in); // not a string!
+    }
+  aJsonEmit(out, '\"');
+  aJsonUtf8 utf8 = { 0, 0x80, 0xBF };
+  for (in = this->getch(); in != '\"' || utf8.need; in = this->getch())
+    {
+      if (in == EOF || in < 32
+          || ((in >= 0x80 || utf8.need) && aJsonCheckUtf8(&utf8, in) == EOF))
+        {
+          return this->scanError(error, aJson_ErrorString, in);
+        }
+      aJsonEmit(out, in);
+      if (in != '\\')
+        {
+          continue;
+        }
+      in = this->getch();
+      if (in == 'u')
+        {
+          aJsonEmit(out, in);
+          for (char i = 0; i < 4; i++)
+            {
+              in = this->getch();
+              if (in == EOF || !isxdigit(in))
+                {
+                  return this->scanError(error, aJson_ErrorString, in);
+                }
+              aJsonEmit(out, in);
+            }
+        }
+      else if (in == EOF || !aJsonUnescape(in))
+        {
+          return this->scanError(error, aJson_ErrorString, in);
+        }
+      else
+        {
+          aJsonEmit(out, in);
+        }
+    }
+  aJsonEmit(out, '\"');
+  return 0;
+}
+
+// Check a number against the JSON grammar and copy it verbatim.
+int
+aJsonStream::scanNumber(aJsonStream *out, aJsonError *error)
+{
+  int in = this->getch();
+  if (in == '-')
+    {
+      aJsonEmit(out, in);
+      in = this->getch();
+    }
+  if (in == '0')
+    {
+      aJsonEmit(out, in);
+      in = this->getch();
+      if (in >= '0' && in <= '9')
+        {
+          return this->scanError(error, aJson_ErrorNumber, in); // no leading zeros
+        }
+    }
+  else if (in >= '1' && in <= '9')
+    {
+      for (; in >= '0' && in <= '9'; in = this->getch())
+        aJsonEmit(out, in);
+    }
+  else
+    {
+      return this->scanError(error, aJson_ErrorNumber, in);
+    }
+  if (in == '.')
+    {
+      aJsonEmit(out, in);
+      in = this->getch();
+      if (in < '0' || in > '9')
+        {
+          return this->scanError(error, aJson_ErrorNumber, in);
+        }
+      for (; in >= '0' && in <= '9'; in = this->getch())
+        aJsonEmit(out, in);
+    }
+  if (in == 'e' || in == 'E')
+    {
+      aJsonEmit(out, in);
+      in = this->getch();
+      if (in == '+' || in == '-')
+        {
+          aJsonEmit(out, in);
+          in = this->getch();
+        }
+      if (in < '0' || in > '9')
+        {
+          return this->scanError(error, aJson_ErrorNumber, in);
+        }
+      for (; in >= '0' && in <= '9'; in = this->getch())
+        aJsonEmit(out, in);
+    }
+  if (in != EOF)
+    {
+      //preserve the last character for the next routine
+      this->ungetch(in);
+    }
+  return 0;
+}
+
+// Check for true, false or null.
+int
+aJsonStream::scanLiteral(aJsonStream *out, const char *literal,
+    aJsonError *error)
+{
+  for (; *literal; literal++)
+    {
+      int in = this->getch();
+      if (in != *literal)
+        {
+          return this->scanError(error, aJson_ErrorLiteral, in);
+        }
+      aJsonEmit(out, in);
+    }
+  return 0;
+}
+
+// Check an object key and the colon after it.
+int
+aJsonStream::scanKey(aJsonStream *out, unsigned char indent, aJsonError *error)
+{
+  this->skip();
+  if (this->scanString(out, error) == EOF)
+    {
+      return EOF;
+    }
+  this->skip();
+  int in = this->getch();
+  if (in != ':')
+    {
+      return this->scanError(error, aJson_ErrorUnexpected, in);
+    }
+  aJsonEmit(out, ':');
+  if (indent)
+    aJsonEmit(out, ' ');
+  return 0;
+}
+
+// A loop instead of recursion: after each value we look at the innermost
+// open container (one bit per level, set for objects) to know what may follow.
+int
+aJsonStream::scanValue(aJsonStream *out, unsigned char indent,
+    aJsonError *error)
+{
+  unsigned char objects[SCAN_MAX_DEPTH / 8];
+  unsigned char depth = 0;
+  if (error)
+    {
+      error->reason = aJson_ErrorNone;
+      error->offset = this->consumed;
+    }
+  for (;;)
+    {
+      //we expect a value
+      this->skip();
+      int in = this->getch();
+      int result = 0;
+      if (in == '{' || in == '[')
+        {
+          if (depth >= SCAN_MAX_DEPTH)
+            {
+              return this->scanError(error, aJson_ErrorDepth, in);
+            }
+          char close = (in == '{') ? '}' : ']';
+          aJsonEmit(out, in);
+          this->skip();
+          int next = this->getch();
+          if (next == close)
+            {
+              aJsonEmit(out, close); // empty
+            }
+          else
+            {
+              if (next != EOF)
+                this->ungetch(next);
+              if (in == '{')
+                objects[depth / 8] |= 1 << (depth % 8);
+              else
+                objects[depth / 8] &= ~(1 << (depth % 8));
+              depth++;
+              aJsonEmitNewline(out, indent, depth);
+              //an object starts with a key
+              if (in == '{' && this->scanKey(out, indent, error) == EOF)
+                {
+                  return EOF;
+                }
+              continue;
+            }
+        }
+      else
+        {
+          if (in != EOF)
+            this->ungetch(in);
+          if (in == '\"')
+            result = this->scanString(out, error);
+          else if (in == '-' || (in >= '0' && in <= '9'))
+            result = this->scanNumber(out, error);
+          else if (in == 't')
+            result = this->scanLiteral(out, "true", error);
+          else if (in == 'f')
+            result = this->scanLiteral(out, "false", error);
+          else if (in == 'n')
+            result = this->scanLiteral(out, "null", error);
+          else
+            result = this->scanError(error, aJson_ErrorUnexpected, this->getch());
+          if (result == EOF)
+            {
+              return EOF;
+            }
+        }
+      //we got a value, close whatever containers end here
+      for (;;)
+        {
+          if (depth == 0)
+            {
+              if (error)
+                error->offset = 0;
+              return 0;
+            }
+          bool object = objects[(depth - 1) / 8] & (1 << ((depth - 1) % 8));
+          this->skip();
+          in = this->getch();
+          if (in == ',')
+            {
+              aJsonEmit(out, ',');
+              aJsonEmitNewline(out, indent, depth);
+              if (object && this->scanKey(out, indent, error) == EOF)
+                {
+                  return EOF;
+                }
+              break;
+            }
+          if (in != (object ? '}' : ']'))
+            {
+              return this->scanError(error, aJson_ErrorUnexpected, in);
+            }
+          depth--;
+          aJsonEmitNewline(out, indent, depth);
+          aJsonEmit(out, in);
+        }
+    }
+}
+
+// Unlike scanValue() we want the whole input: only whitespace may follow.
+int
+aJsonStream::scanDocument(aJsonError *error)
+{
+  unsigned long start = this->consumed;
+  if (this->scanValue(NULL, 0, error) == EOF)
+    {
+      return EOF;
+    }
+  this->skip();
+  int in = this->getch();
+  if (in == EOF)
+    {
+      return 0;
+    }
+  if (error)
+    {
+      error->offset = start;
+    }
+  return this->scanError(error, aJson_ErrorUnexpected, in);
+}
+
+// Render an object to text.
+int
+aJsonStream::printObject(aJsonObject *item)
+{
+  if (item == NULL)
+    {
+      //nothing to do
+      return 0;
+    }
+  if (aJsonClass::materialize(item) == EOF)
+    {
+      return EOF;
+    }
+  aJsonObject *child = item->child;
+  if (this->print('{') == EOF)
+    {
+      return EOF;
+    }
+  while (child)
+    {
+      if (this->printStringPtr(child->name) == EOF)
+        {
+          return EOF;
+        }
+      if (this->print(':') == EOF)
+        {
+          return EOF;
+        }
+      if (this->printValue(child) == EOF)
+        {
+          return EOF;
+        }
+      child = child->next;
+      if (child)
+        {
+          if (this->print(',') == EOF)
+            {
+              return EOF;
+            }
+        }
+    }
+  if (this->print('}') == EOF)
+    {
+      return EOF;
+    }
+  return 0;
+}
+
+void
+aJsonSerializer::reset(aJsonObject *item)
+{
+  depth = 0;
+  phase = item ? Value : Done;
+  node = item;
+  text = NULL;
+  escape = false;
+  chunk_len = chunk_pos = 0;
+  total = 0;
+}
+
+size_t
+aJsonSerializer::write(Print *sink, size_t limit)
+{
+  size_t written = 0;
+  while (written < limit)
+    {
+      if (chunk_pos == chunk_len)
+        {
+          //the last piece is out, make the next one
+          chunk_pos = chunk_len = 0;
+          if (!this->step())
+            {
+              break;
+            }
+          continue;
+        }
+      if (sink->write((uint8_t) chunk[chunk_pos]) == 0)
+        {
+          //the sink is full, try again later
+          break;
+        }
+      chunk_pos++;
+      written++;
+    }
+  total += written;
+  return written;
+}
+
+// Put the next piece of output into chunk, false if there is none.
+bool
+aJsonSerializer::step()
+{
+  if (text != NULL)
+    {
+      //strings go out a character at a time
+      char ch = *text;
+      if (ch == 0)
+        {
+          text = NULL;
+          if (escape)
+            {
+              chunk[chunk_len++] = '\"';
+            }
+        }
+      else if (!escape
+          || ((unsigned char) ch > 31 && ch != '\"' && ch != '\\'))
+        {
+          chunk[chunk_len++] = ch;
+          text++;
+        }
+      else
+        {
+          char letter = aJsonEscape(*text);
+          chunk[chunk_len++] = '\\';
+          if (letter)
+            {
+              chunk[chunk_len++] = letter;
+            }
+          else
+            {
+              chunk[chunk_len++] = 'u';
+              chunk[chunk_len++] = '0';
+              chunk[chunk_len++] = '0';
+              chunk[chunk_len++] = "0123456789abcdef"[(*text >> 4) & 0xF];
+              chunk[chunk_len++] = "0123456789abcdef"[*text & 0xF];
+            }
+          text++;
+        }
+      return true;
+    }
+  switch (phase)
+    {
+  case Value:
+    this->value(node);
+    return true;
+  case Colon:
+    chunk[chunk_len++] = ':';
+    phase = Value;
+    return true;
+  case Member:
+    {
+      Frame &frame = stack[depth - 1];
+      if ((frame.item->flags & aJson_Packed)
+          && frame.index < frame.item->valuepacked->count)
+        {
+          aJsonPacked *packed = frame.item->valuepacked;
+          aJsonObject number;
+          number.type = packed->type;
+          number.flags = 0;
+          if (packed->type == aJson_Int)
+            number.valueint = packed->ints[frame.index];
+          else
+            number.valuefloat = packed->floats[frame.index];
+          if (frame.index++)
+            {
+              chunk[chunk_len++] = ',';
+            }
+          this->value(&number);
+        }
+      else if (frame.child != NULL)
+        {
+          node = frame.child;
+          frame.child = node->next;
+          if (frame.index)
+            {
+              chunk[chunk_len++] = ',';
+            }
+          frame.index = 1;
+          if (frame.item->type == aJson_Object)
+            {
+              chunk[chunk_len++] = '\"';
+              text = node->name ? node->name : "";
+              escape = true;
+              phase = Colon;
+            }
+          else
+            {
+              phase = Value;
+            }
+        }
+      else
+        {
+          this->close();
+        }
+      return true;
+    }
+  default:
+    return false;
+    }
+}
+
+// Start writing item.
+void
+aJsonSerializer::value(aJsonObject *item)
+{
+  char type = item->type;
+  if (type == aJson_Array || type == aJson_Object)
+    {
+      if (depth == SERIALIZER_MAX_DEPTH
+          || aJsonClass::materialize(item) == EOF)
+        {
+          phase = Failed;
+          return;
+        }
+      Frame &frame = stack[depth++];
+      frame.item = item;
+      frame.child = item->child;
+      frame.index = 0;
+      chunk[chunk_len++] = (type == aJson_Array) ? '[' : '{';
+      phase = Member;
+      return;
+    }
+  phase = depth ? Member : Done;
+  if (type == aJson_String)
+    {
+      chunk[chunk_len++] = '\"';
+      text = item->valuestring ? item->valuestring : "";
+      escape = true;
+    }
+  else if (item->flags & aJson_Raw)
+    {
+      text = item->valueraw->text;
+      escape = false;
+    }
+  else
+    {
+      //null, booleans and numbers always fit into the chunk
+      chunk[chunk_len] = 0;
+      aJsonStringStream out(NULL, chunk + chunk_len, sizeof(chunk) - chunk_len);
+      out.printValue(item);
+      chunk_len += strlen(chunk + chunk_len);
+    }
+}
+
+// Finish the innermost array or object.
+void
+aJsonSerializer::close()
+{
+  Frame &frame = stack[--depth];
+  bool array = frame.item->type == aJson_Array;
+  chunk[chunk_len++] = array ? ']' : '}';
+  phase = depth ? Member : Done;
+}
+
+void
+aJsonParser::reset()
+{
+  length = 0;
+  state = Start;
+  depth = 0;
+  in_string = escaped = false;
+}
+
+// Look at the next character, EOF if it belongs to the next document.
+int
+aJsonParser::add(char ch)
+{
+  switch (state)
+    {
+  case Start:
+    if ((unsigned char) ch <= 32)
+      {
+        return 0; // whitespace between documents
+      }
+    state = (ch == '{' || ch == '[') ? Nested : (ch == '\"') ? String : Scalar;
+    in_string = (state == String);
+    depth = 1;
+    break;
+  case Nested:
+  case String:
+    if (escaped)
+      {
+        escaped = false;
+      }
+    else if (in_string && ch == '\\')
+      {
+        escaped = true;
+      }
+    else if (ch == '\"')
+      {
+        in_string = !in_string;
+      }
+    else if (in_string)
+      {
+        //brackets in strings do not count
+      }
+    else if (ch == '{' || ch == '[')
+      {
+        if (depth == 255)
+          {
+            state = Failed;
+            return EOF;
+          }
+        depth++;
+      }
+    else if (ch == '}' || ch == ']')
+      {
+        depth--;
+      }
+    break;
+  case Scalar:
+    if ((unsigned char) ch <= 32 || ch == ',' || ch == ']' || ch == '}'
+        || ch == '{' || ch == '[' || ch == '\"')
+      {
+        state = Ready;
+        return EOF;
+      }
+    break;
+  default:
+    return EOF;
+    }
+  if (length + 1 >= size)
+    {
+      state = Failed;
+      return EOF;
+    }
+  buffer[length++] = ch;
+  buffer[length] = 0;
+  if ((state == String && !in_string) || (state == Nested && depth == 0))
+    {
+      state = Ready;
+    }
+  return 0;
+}
+
+size_t
+aJsonParser::feed(const char *data, size_t len)
+{
+  size_t used = 0;
+  while (used < len && this->add(data[used]) != EOF)
+    {
+      used++;
+      if (state == Ready)
+        {
+          break;
+        }
+    }
+  return used;
+}
+
+size_t
+aJsonParser::feed(Stream *stream)
+{
+  size_t used = 0;
+  while (state != Ready && state != Failed && stream->available())
+    {
+      int ch = stream->peek();
+      if (ch == EOF || this->add(ch) == EOF)
+        {
+          break;
+        }
+      stream->read();
+      used++;
+    }
+  return used;
+}
+
+aJsonObject*
+aJsonParser::take()
+{
+  if (state != Ready)
+    {
+      return NULL;
+    }
+  aJsonStringStream stream(buffer, NULL, 0, length);
+  aJsonObject *item = aJson.parse(&stream);
+  reset();
+  return item;
+}
+
+aJsonArrayReader::~aJsonArrayReader()
+{
+  release();
+}
+
+// Delete the element returned last.
+void
+aJsonArrayReader::release()
+{
+  if (item != NULL)
+    {
+      aJson.deleteItem(item, stream->getAllocator());
+      item = NULL;
+    }
+}
+
+aJsonObject*
+aJsonArrayReader::next()
+{
+  release();
+  if (stream == NULL || state == Done || state == Failed)
+    {
+      return NULL;
+    }
+  if (stream->skip() == EOF)
+    {
+      state = Failed;
+      return NULL;
+    }
+  int in = stream->getch();
+  if (state == Start)
+    {
+      if (in != '[')
+        {
+          state = Failed;
+          return NULL;
+        }
+      if (stream->skip() == EOF)
+        {
+          state = Failed;
+          return NULL;
+        }
+      in = stream->getch();
+      if (in == ']')
+        {
+          state = Done;
+          return NULL;
+        }
+      stream->ungetch(in);
+    }
+  else if (in == ']')
+    {
+      state = Done;
+      return NULL;
+    }
+  else if (in != ',')
+    {
+      state = Failed;
+      return NULL;
+    }
+  item = aJson.parse(stream);
+  if (item == NULL)
+    {
+      state = Failed;
+      return NULL;
+    }
+  state = Items;
+  count++;
+  return item;
+}
+
+// Find the field for a key read by readString() into a buffer of len bytes.
+static const aJsonField*
+aJsonFindField(const aJsonField *fields, unsigned char count, const char *key,
+    int length, size_t len)
+{
+  for (unsigned char i = 0; i < count; i++)
+    {
+      //keys too long for the buffer were cut off, so they never match
+      if (fields[i].length != length || (size_t) length >= len)
+        continue;
+      if (!strcasecmp(key, fields[i].key))
+        return &fields[i];
+    }
+  return NULL;
+}
+
+// Store value into an integer member of the given size.
+static void
+aJsonStoreInt(void *member, size_t size, long value)
+{
+  if (size == sizeof(char))
+    *(signed char*) member = (signed char) value;
+  else if (size == sizeof(short))
+    *(short*) member = (short) value;
+  else if (size == sizeof(int))
+    *(int*) member = (int) value;
+  else
+    *(long*) member = value;
+}
+
+static long
+aJsonLoadInt(const void *member, size_t size)
+{
+  if (size == sizeof(char))
+    return *(const signed char*) member;
+  else if (size == sizeof(short))
+    return *(const short*) member;
+  else if (size == sizeof(int))
+    return *(const int*) member;
+  return *(const long*) member;
+}
+
+// Parse an object into a struct, only scalars are ever put into a (stack) item.
+int
+aJsonStream::parseStruct(void *target, const aJsonField *fields,
+    unsigned char count)
+{
+  if (this->skip() == EOF || this->getch() != '{')
+    {
+      return EOF; // not an object!
+    }
+  this->skip();
+  int in = this->getch();
+  if (in == '}')
+    {
+      return 0; // empty object.
+    }
+  this->ungetch(in);
+  do
+    {
+      char key[PROJECTION_KEY_LEN];
+      this->skip();
+      int length = this->readString(key, sizeof(key));
+      if (length == EOF)
+        {
+          return EOF;
+        }
+      this->skip();
+      if (this->getch() != ':')
+        {
+          return EOF;
+        }
+      this->skip();
+      const aJsonField *field = aJsonFindField(fields, count, key, length,
+          sizeof(key));
+      if (field == NULL)
+        {
+          if (this->skipValue() == EOF)
+            {
+              return EOF;
+            }
+        }
+      else if (this->parseField((char*) target + field->offset, field) == EOF)
+        {
+          return EOF;
+        }
+      this->skip();
+      in = this->getch();
+    }
+  while (in == ',');
+  return (in == '}') ? 0 : EOF;
+}
+
+// Parse the value of a field into its member.
+int
+aJsonStream::parseField(void *member, const aJsonField *field)
+{
+  int in = this->getch();
+  if (in == EOF)
+    {
+      return EOF;
+    }
+  this->ungetch(in);
+  aJsonObject value;
+  if (in == 'n')
+    {
+      //null leaves the member as it is
+      return this->parseValue(&value, NULL);
+    }
+  if (field->type == aJson_String)
+    {
+      return (this->readString((char*) member, field->size) == EOF) ? EOF : 0;
+    }
+  if (field->type == aJson_Object)
+    {
+      return this->parseStruct(member, field->fields, field->count);
+    }
+  if (in == '\"' || in == '[' || in == '{')
+    {
+      return EOF; // parseValue() would allocate, and it is wrong anyway
+    }
+  if ((in == '-' || (in >= '0' && in <= '9')) ? this->parseNumber(&value) == EOF
+      : this->parseValue(&value, NULL) == EOF)
+    {
+      return EOF;
+    }
+  switch (field->type)
+    {
+  case aJson_Boolean:
+    if (value.type != aJson_Boolean)
+      {
+        return EOF;
+      }
+    *(bool*) member = value.valuebool;
+    break;
+  case aJson_Int:
+    if (value.type == aJson_Int)
+      aJsonStoreInt(member, field->size, value.valueint);
+    else if (value.type == aJson_Float)
+      aJsonStoreInt(member, field->size, (long) value.valuefloat);
+    else
+      return EOF;
+    break;
+  case aJson_Float:
+    if (value.type == aJson_Int)
+      value.valuefloat = value.valueint;
+    else if (value.type != aJson_Float)
+      return EOF;
+    if (field->size == sizeof(float))
+      *(float*) member = value.valuefloat;
+    else
+      *(double*) member = value.valuefloat;
+    break;
+  default:
+    return EOF;
+    }
+  return 0;
+}
+
+// Print a struct as object.
+int
+aJsonStream::printStruct(const void *source, const aJsonField *fields,
+    unsigned char count)
+{
+  if (this->print('{') == EOF)
+    {
+      return EOF;
+    }
+  for (unsigned char i = 0; i < count; i++)
+    {
+      const aJsonField *field = &fields[i];
+      const char *member = (const char*) source + field->offset;
+      if (i && this->print(',') == EOF)
+        {
+          return EOF;
+        }
+      if (this->printStringPtr(field->key) == EOF
+          || this->print(':') == EOF)
+        {
+          return EOF;
+        }
+      int result = 0;
+      aJsonObject value;
+      value.flags = 0;
+      switch (field->type)
+        {
+      case aJson_Boolean:
+        result = this->print(*(const bool*) member ? "true" : "false");
+        break;
+      case aJson_Int:
+        result = this->print(aJsonLoadInt(member, field->size), DEC);
+        break;
+      case aJson_Float:
+        value.valuefloat = (field->size == sizeof(float))
+            ? *(const float*) member : *(const double*) member;
+        result = this->printFloat(&value);
+        break;
+      case aJson_String:
+        result = this->printStringPtr(member);
+        break;
+      case aJson_Object:
+        result = this->printStruct(member, field->fields, field->count);
+        break;
+        }
+      if (result == EOF)
+        {
+          return EOF;
+        }
+    }
+  if (this->print('}') == EOF)
+    {
+      return EOF;
+    }
+  return 0;
+}
+
+// Put a comma before every item of an array or object but the first.
+int
+aJsonStream::writeComma()
+{
+  if (writer_depth == 0)
+    {
+      return 0;
+    }
+  unsigned long level = 1UL << (writer_depth - 1);
+  if (writer_items & level)
+    {
+      if (this->print(',') == EOF)
+        {
+          return EOF;
+        }
+    }
+  writer_items |= level;
+  return 0;
+}
+
+// Values go into arrays, at the top or after a key.
+int
+aJsonStream::writeSeparator()
+{
+  if (writer_key)
+    {
+      writer_key = false;
+      return 0;
+    }
+  if (writer_depth != 0 && (writer_objects & (1UL << (writer_depth - 1))))
+    {
+      return EOF; // a value in an object needs a key
+    }
+  return this->writeComma();
+}
+
+int
+aJsonStream::beginObject()
+{
+  if (writer_depth == WRITER_MAX_DEPTH || this->writeSeparator() == EOF
+      || this->print('{') == EOF)
+    {
+      return EOF;
+    }
+  unsigned long level = 1UL << writer_depth++;
+  writer_objects |= level;
+  writer_items &= ~level;
+  return 0;
+}
+
+int
+aJsonStream::beginArray()
+{
+  if (writer_depth == WRITER_MAX_DEPTH || this->writeSeparator() == EOF
+      || this->print('[') == EOF)
+    {
+      return EOF;
+    }
+  unsigned long level = 1UL << writer_depth++;
+  writer_objects &= ~level;
+  writer_items &= ~level;
+  return 0;
+}
+
+// Close the innermost object or array, if it is one.
+int
+aJsonStream::writeClose(char bracket)
+{
+  if (writer_depth == 0 || writer_key)
+    {
+      return EOF;
+    }
+  bool object = writer_objects & (1UL << (writer_depth - 1));
+  if (object != (bracket == '}'))
+    {
+      return EOF;
+    }
+  writer_depth--;
+  return (this->print(bracket) == EOF) ? EOF : 0;
+}
+
+int
+aJsonStream::endObject()
+{
+  return this->writeClose('}');
+}
+
+int
+aJsonStream::endArray()
+{
+  return this->writeClose(']');
+}
+
+int
+aJsonStream::key(const char *name)
+{
+  if (writer_depth == 0 || writer_key
+      || !(writer_objects & (1UL << (writer_depth - 1))))
+    {
+      return EOF; // keys only go into objects
+    }
+  if (this->writeComma() == EOF || this->printStringPtr(name) == EOF
+      || this->print(':') == EOF)
+    {
+      return EOF;
+    }
+  writer_key = true;
+  return 0;
+}
+
+int
+aJsonStream::value(int number)
+{
+  return this->value((long) number);
+}
+
+int
+aJsonStream::value(long number)
+{
+  if (this->writeSeparator() == EOF)
+    {
+      return EOF;
+    }
+  return (this->print(number, DEC) == EOF) ? EOF : 0;
+}
+
+int
+aJsonStream::value(double number)
+{
+  if (this->writeSeparator() == EOF)
+    {
+      return EOF;
+    }
+  aJsonObject item;
+  item.flags = 0;
+  item.valuefloat = number;
+  return this->printFloat(&item);
+}
+
+int
+aJsonStream::value(const char *string)
+{
+  if (this->writeSeparator() == EOF)
+    {
+      return EOF;
+    }
+  return this->printStringPtr(string);
+}
+
+int
+aJsonStream::value(bool boolean)
+{
+  if (this->writeSeparator() == EOF)
+    {
+      return EOF;
+    }
+  return (this->print(boolean ? "true" : "false") == EOF) ? EOF : 0;
+}
+
+int
+aJsonStream::value(aJsonObject *item)
+{
+  if (this->writeSeparator() == EOF)
+    {
+      return EOF;
+    }
+  return this->printValue(item);
+}
+
+int
+aJsonStream::nullValue()
+{
+  if (this->writeSeparator() == EOF)
+    {
+      return EOF;
+    }
+  return (this->print("null") == EOF) ? EOF : 0;
+}
+
+// Get Array size/item / object item.
+unsigned char
+aJsonClass::getArraySize(aJsonObject *array)
+{
+  if (materialize(array) == EOF)
+    return 0;
+  if (array->flags & aJson_Packed)
+    return array->valuepacked->count;
+  aJsonObject *c = array->child;
+  unsigned char i = 0;
+  while (c)
+    i++, c = c->next;
+  return i;
+}
+aJsonObject*
+aJsonClass::getArrayItem(aJsonObject *array, unsigned char item)
+{
+  if (expand(array, false) == EOF)
+    return NULL;
+  aJsonObject *c = array->child;
+  while (c && item > 0)
+    item--, c = c->next;
+  return c;
+}
+
+// Numbers, converting raw ones once.
+static aJsonObject*
+aJsonNumber(aJsonObject *item, aJsonObject *value)
+{
+  if (!(item->flags & aJson_Raw))
+    return item;
+  aJsonRaw *raw = item->valueraw;
+  if (!raw->converted)
+    {
+      aJsonStringStream stream(raw->text);
+      value->type = aJson_Int;
+      value->valueint = 0;
+      stream.parseNumber(value);
+      if (value->type == aJson_Int && item->type == aJson_Int)
+        raw->valueint = value->valueint;
+      else
+        raw->valuefloat = (value->type == aJson_Int) ? value->valueint
+            : value->valuefloat;
+      raw->converted = 1;
+    }
+  value->type = item->type;
+  if (item->type == aJson_Int)
+    value->valueint = raw->valueint;
+  else
+    value->valuefloat = raw->valuefloat;
+  return value;
+}
+int
+aJsonClass::getInt(aJsonObject *item)
+{
+  aJsonObject value;
+  if (!item)
+    return 0;
+  aJsonObject *number = aJsonNumber(item, &value);
+  if (number->type == aJson_Float)
+    return (int) number->valuefloat;
+  return (number->type == aJson_Int) ? number->valueint : 0;
+}
+double
+aJsonClass::getFloat(aJsonObject *item)
+{
+  aJsonObject value;
+  if (!item)
+    return 0;
+  aJsonObject *number = aJsonNumber(item, &value);
+  if (number->type == aJson_Int)
+    return number->valueint;
+  return (number->type == aJson_Float) ? number->valuefloat : 0;
+}
+
+// Packed arrays.
+int*
+aJsonClass::getIntArray(aJsonObject *array, unsigned char *count)
+{
+  if (!array || !(array->flags & aJson_Packed)
+      || array->valuepacked->type != aJson_Int)
+    return NULL;
+  *count = array->valuepacked->count;
+  return array->valuepacked->ints;
+}
+double*
+aJsonClass::getFloatArray(aJsonObject *array, unsigned char *count)
+{
+  if (!array || !(array->flags & aJson_Packed)
+      || array->valuepacked->type != aJson_Float)
+    return NULL;
+  *count = array->valuepacked->count;
+  return array->valuepacked->floats;
+}
+int
+aJsonClass::pack(aJsonObject *array)
+{
+  if (!array || array->type != aJson_Array || materialize(array) == EOF)
+    return EOF;
+  if (array->flags & aJson_Packed)
+    return 0;
+  if (aJsonIsFrozen(array) || unshare(array) == EOF)
+    return EOF;
+  if (!array->child)
+    return EOF;
+  //ints and floats mixed would have to become doubles, which changes them
+  char type = array->child->type;
+  if (type != aJson_Int && type != aJson_Float)
+    return EOF;
+  unsigned char count = 0;
+  aJsonObject *c;
+  for (c = array->child; c; c = c->next, count++)
+    {
+      if (count == 255 || c->type != type)
+        return EOF;
+    }
+  aJsonPacked *packed = aJsonNewPacked(type, count);
+  if (!packed)
+    return EOF;
+  for (c = array->child; c; c = c->next)
+    {
+      if (type == aJson_Int)
+        packed->ints[packed->count++] = getInt(c);
+      else
+        packed->floats[packed->count++] = getFloat(c);
+    }
+  deleteItem(array->child);
+  array->child = NULL;
+  array->valuepacked = packed;
+  array->flags |= aJson_Packed;
+  return 0;
+}
+int
+aJsonClass::unpack(aJsonObject *array)
+{
+  if (!array || !(array->flags & aJson_Packed))
+    return 0;
+  aJsonPacked *packed = array->valuepacked;
+  aJsonObject *first = NULL, *p = NULL;
+  for (unsigned char i = 0; i < packed->count; i++)
+    {
+      aJsonObject *n = newItem();
+      if (!n)
+        {
+          //plain numbers, nothing else to free
+          while (first)
+            {
+              p = first->next;
+              aJsonFreeNode(first, sizeof(aJsonObject));
+              first = p;
+            }
+          return EOF; // memory fail, the array stays packed
+        }
+      n->type = packed->type;
+      if (packed->type == aJson_Int)
+        n->valueint = packed->ints[i];
+      else
+        n->valuefloat = packed->floats[i];
+      if (p)
+        {
+          p->next = n;
+          n->prev = p;
+        }
+      else
+        first = n;
+      p = n;
+    }
+  aJsonFreePacked(packed);
+  array->valuepacked = NULL;
+  array->flags &= ~aJson_Packed;
+  array->child = first;
+  return 0;
+}
+
+int
+aJsonClass::materialize(aJsonObject *item)
+{
+  if (!item || !(item->flags & aJson_Lazy))
+    return 0;
+  aJsonText text = item->valuetext;
+  unsigned char flags = item->flags;
+  char type = item->type;
+  aJsonStringStream stream((char*) text.start, NULL, 0, text.length);
+  stream.setOptions(flags >> aJson_LazyShift);
+  item->flags &= ~(aJson_Lazy | (0xff << aJson_LazyShift));
+  item->valuetext.start = NULL;
+  item->valuetext.length = 0;
+  if (stream.parseValue(item, NULL) == EOF)
+    {
+      //drop what we got and stay lazy
+      aJson.deleteValue(item);
+      item->type = type;
+      item->flags = flags;
+      item->valuetext = text;
+      return EOF;
+    }
+  return 0;
+}
+
+// Get an object or array ready to walk and, with write, change its children.
+// Shared children are walked as they are, only writing copies them.
+int
+aJsonClass::expand(aJsonObject *item, bool write)
+{
+  if (aJsonIsFrozen(item))
+    return write ? EOF : 0; // frozen items are always ready to read
+  if (materialize(item) == EOF || unpack(item) == EOF)
+    return EOF;
+  return write ? unshare(item) : 0;
+}
+
+// Give a shared object or array its own children, the objects and arrays
+// among them stay shared one level further down.
+int
+aJsonClass::unshare(aJsonObject *item)
+{
+  if (!item || !(item->flags & aJson_Shared))
+    return 0;
+  aJsonShare *share = item->valueshare;
+  if (share->users > 1)
+    {
+      aJsonObject *first = NULL, *last = NULL;
+      for (aJsonObject *c = item->child; c; c = c->next)
+        {
+          aJsonObject *n = aJson.share(c);
+          if (!n)
+            {
+              aJson.deleteItem(first);
+              return EOF; // memory fail, still shared
+            }
+          if (last)
+            aJson.suffixObject(last, n);
+          else
+            first = n;
+          last = n;
+        }
+      share->users--;
+      item->child = first;
+    }
+  else
+    {
+      //nobody else has them any more
+      aJsonFree(share, sizeof(aJsonShare));
+    }
+  item->valueshare = NULL;
+  item->flags &= ~aJson_Shared;
+  return 0;
+}
+
+aJsonObject*
+aJsonClass::getObjectItem(aJsonObject *object, const char *string)
+{
+  if (expand(object, false) == EOF)
+    return NULL;
+  aJsonObject *c = object->child;
+  while (c && strcasecmp(c->name, string))
+    c = c->next;
+  return c;
+}
+
+// Case insensitive hash of a key, matching the strcasecmp() of getObjectItem.
+static unsigned int
+aJsonKeyHash(const char *key)
+{
+  unsigned int hash = 5381;
+  while (*key)
+    hash = (hash * 33) ^ (unsigned char) tolower(*key++);
+  return hash;
+}
+
+// Finish a path segment whose key has been copied to segment->key.
+static void
+aJsonSegmentInit(aJsonPathSegment *segment, unsigned char length)
+{
+  const char *key = segment->key;
+  segment->length = length;
+  segment->hash = aJsonKeyHash(key);
+  segment->index = -1;
+  //array indexes are plain decimals without leading zeros
+  if (length == 0 || length > 3 || (key[0] == '0' && length > 1))
+    return;
+  int index = 0;
+  for (unsigned char i = 0; i < length; i++)
+    {
+      if (key[i] < '0' || key[i] > '9')
+        return;
+      index = index * 10 + (key[i] - '0');
+    }
+  segment->index = index;
+}
+
+// Compile a JSON Pointer or dotted path into one allocation.
+aJsonPath*
+aJsonClass::compilePath(const char *path)
+{
+  if (path == NULL)
+    return NULL;
+  size_t path_len = strlen(path);
+  //every segment is introduced by '/', '.' or '[' - this is an upper bound
+  unsigned int max_segments = 1;
+  for (const char *p = path; *p; p++)
+    if (*p == '/' || *p == '.' || *p == '[')
+      max_segments++;
+  if (max_segments > 255)
+    return NULL;
+  size_t size = sizeof(aJsonPath) + max_segments * sizeof(aJsonPathSegment)
+      + path_len + max_segments;
+  aJsonPath *compiled = (aJsonPath*) aJsonMalloc(size);
+  if (compiled == NULL)
+    return NULL;
+  compiled->size = size;
+  compiled->count = 0;
+  compiled->step = 0;
+  compiled->exact = (*path == '/');
+  compiled->segments = (aJsonPathSegment*) (compiled + 1);
+  char *keys = (char*) (compiled->segments + max_segments);
+
+  const char *p = path;
+  bool pointer = (*p == '/');
+  while (*p)
+    {
+      aJsonPathSegment *segment = &compiled->segments[compiled->count++];
+      char *key = keys;
+      if (pointer)
+        {
+          //skip the '/' and unescape ~0 and ~1 up to the next one
+          p++;
+          while (*p && *p != '/')
+            {
+              if (*p == '~')
+                {
+                  p++;
+                  if (*p == '0')
+                    *keys++ = '~';
+                  else if (*p == '1')
+                    *keys++ = '/';
+                  else
+                    {
+                      deletePath(compiled);
+                      return NULL;
+                    }
+                  p++;
+                }
+              else
+                *keys++ = *p++;
+            }
+        }
+      else if (*p == '[')
+        {
+          p++;
+          while (*p && *p != ']')
+            *keys++ = *p++;
+          if (*p != ']')
+            {
+              deletePath(compiled);
+              return NULL;
+            }
+          p++;
+          if (*p == '.')
+            p++;
+        }
+      else
+        {
+          while (*p && *p != '.' && *p != '[')
+            *keys++ = *p++;
+          if (*p == '.')
+            p++;
+        }
+      if (keys - key > 255)
+        {
+          deletePath(compiled);
+          return NULL;
+        }
+      *keys++ = 0;
+      segment->key = key;
+      aJsonSegmentInit(segment, (unsigned char) (keys - key - 1));
+    }
+  return compiled;
+}
+
+void
+aJsonClass::deletePath(aJsonPath *path)
+{
+  if (path)
+    aJsonFree(path, path->size);
+}
+
+// Does child, found at position index of its parent, match the segment?
+static bool
+aJsonSegmentMatches(const aJsonPathSegment *segment, bool exact, char parent_type,
+    aJsonObject *child, unsigned char index)
+{
+  if (parent_type == aJson_Array)
+    return segment->index == index;
+  if (!child->name)
+    return false;
+  if (exact)
+    return *child->name == *segment->key && !strcmp(child->name, segment->key);
+  return tolower(*child->name) == tolower(*segment->key)
+      && !strcasecmp(child->name, segment->key);
+}
+
+// Follow the segments of path from first up to last, starting at item. With
+// write every level on the way gets its own children, to change what is found.
+aJsonObject*
+aJsonClass::walkPath(aJsonObject *item, aJsonPath *path, unsigned char first,
+    unsigned char last, bool write)
+{
+  aJsonObject *c = item;
+  for (unsigned char i = first; c && i < last; i++)
+    {
+      const aJsonPathSegment *segment = &path->segments[i];
+      if (c->type == aJson_Array)
+        {
+          int index = segment->index;
+          if (index < 0 || expand(c, write) == EOF)
+            return NULL;
+          c = c->child;
+          while (c && index > 0)
+            index--, c = c->next;
+        }
+      else if (c->type == aJson_Object)
+        {
+          if (expand(c, write) == EOF)
+            return NULL;
+          aJsonObject *child = c->child;
+          while (child && !aJsonSegmentMatches(segment, path->exact, aJson_Object, child, 0))
+            child = child->next;
+          c = child;
+        }
+      else
+        {
+          return NULL;
+        }
+    }
+  return c;
+}
+
+aJsonObject*
+aJsonClass::getPathItem(aJsonObject *root, aJsonPath *path)
+{
+  if (root == NULL || path == NULL)
+    return NULL;
+  return walkPath(root, path, 0, path->count);
+}
+
+aJsonObject*
+aJsonClass::getPathItem(aJsonObject *root, const char *path)
+{
+  aJsonPath *compiled = compilePath(path);
+  aJsonObject *result = getPathItem(root, compiled);
+  deletePath(compiled);
+  return result;
+}
+
+// All paths advance one level per round. Whenever a path is still waiting at a
+// container, the children of that container are walked once and matched against
+// every path waiting there; step records how far each path got.
+unsigned char
+aJsonClass::getPathItems(aJsonObject *root, aJsonPath **paths,
+    unsigned char count, aJsonObject **results)
+{
+  unsigned char i, j, found = 0;
+  for (i = 0; i < count; i++)
+    {
+      results[i] = paths[i] ? root : NULL;
+      if (paths[i])
+        paths[i]->step = 0;
+    }
+  bool active = true;
+  for (unsigned char depth = 0; active; depth++)
+    {
+      active = false;
+      for (i = 0; i < count; i++)
+        {
+          aJsonObject *parent = results[i];
+          if (!parent || paths[i]->count <= depth || paths[i]->step != depth)
+            continue;
+          active = true;
+          if ((parent->type == aJson_Array || parent->type == aJson_Object)
+              && expand(parent, false) == 0)
+            {
+              unsigned char index = 0;
+              for (aJsonObject *c = parent->child; c; c = c->next, index++)
+                {
+                  unsigned int hash = 0;
+                  if (parent->type == aJson_Object && c->name)
+                    hash = aJsonKeyHash(c->name);
+                  for (j = i; j < count; j++)
+                    {
+                      aJsonPath *path = paths[j];
+                      if (results[j] != parent || path->count <= depth
+                          || path->step != depth)
+                        continue;
+                      const aJsonPathSegment *segment = &path->segments[depth];
+                      if ((parent->type == aJson_Object && segment->hash != hash)
+                          || !aJsonSegmentMatches(segment, path->exact,
+                              parent->type, c, index))
+                        continue;
+                      results[j] = c;
+                      path->step = depth + 1;
+                    }
+                }
+            }
+          //whoever is still waiting on this parent has no match
+          for (j = i; j < count; j++)
+            if (results[j] == parent && paths[j]->count > depth
+                && paths[j]->step == depth)
+              results[j] = NULL;
+        }
+    }
+  for (i = 0; i < count; i++)
+    if (results[i])
+      found++;
+  return found;
+}
+
+// Utility for array list handling.
+void
+aJsonClass::suffixObject(aJsonObject *prev, aJsonObject *item)
+{
+  prev->next = item;
+  item->prev = prev;
+}
+aJsonObject*
+aJsonClass::share(aJsonObject *item)
+{
+  if (!item || materialize(item) == EOF)
+    return NULL;
+  char type = item->type;
+  if ((type != aJson_Array && type != aJson_Object)
+      || (item->flags & aJson_Packed) || aJsonIsFrozen(item))
+    return duplicate(item);
+  if (!(item->flags & aJson_Shared))
+    {
+      item->valueshare = (aJsonShare*) aJsonMalloc(sizeof(aJsonShare));
+      if (!item->valueshare)
+        return NULL;
+      item->valueshare->users = 1;
+      item->flags |= aJson_Shared;
+    }
+  aJsonObject *copy = newItem();
+  if (!copy)
+    return NULL;
+  copy->type = type;
+  copy->flags = aJson_Shared;
+  copy->child = item->child;
+  copy->valueshare = item->valueshare;
+  copy->valueshare->users++;
+  if (item->name && !(copy->name = aJsonStrdup(item->name)))
+    {
+      deleteItem(copy);
+      return NULL;
+    }
+  return copy;
+}
+
+// Add item to array/object. Frozen items belong to a cache or publisher,
+// the container would free them behind its back.
+int
+aJsonClass::addItemToArray(aJsonObject *array, aJsonObject *item)
+{
+  if (!item || !array || aJsonIsFrozen(item) || expand(array) == EOF)
+    return EOF;
+  aJsonObject *c = array->child;
+  if (!c)
+    {
+      array->child = item;
+    }
+  else
+    {
+      while (c && c->next)
+        c = c->next;
+      suffixObject(c, item);
+    }
+  return 0;
+}
+// Join the items of two arrays or objects, e.g. parsed separately by parseElements().
+int
+aJsonClass::appendArray(aJsonObject *array, aJsonObject *part)
+{
+  if (!array || !part || array == part)
+    return EOF;
+  char type = array->type;
+  if ((type != aJson_Array && type != aJson_Object)
+      || part->type != type)
+    return EOF;
+  if (expand(array) == EOF || expand(part) == EOF)
+    return EOF;
+  if (!part->child)
+    return 0;
+  aJsonObject *c = array->child;
+  if (!c)
+    {
+      array->child = part->child;
+    }
+  else
+    {
+      while (c->next)
+        c = c->next;
+      suffixObject(c, part->child);
+    }
+  part->child = NULL;
+  return 0;
+}
+int
+aJsonClass::addItemToObject(aJsonObject *object, const char *string,
+    aJsonObject *item)
+{
+  if (!item || !object || aJsonIsFrozen(item) || expand(object) == EOF)
+    return EOF;
+  char *name = aJsonStrdup(string);
+  if (!name)
+    return EOF; // memory fail
+  aJsonFreeName(item);
+  item->name = name;
+  return addItemToArray(object, item);
+}
+int
+aJsonClass::addItemToObjectStatic(aJsonObject *object, const char *string,
+    aJsonObject *item)
+{
+  if (!item || !object || aJsonIsFrozen(item) || expand(object) == EOF)
+    return EOF;
+  aJsonFreeName(item);
+  item->name = (char*) string;
+  item->flags |= aJson_StaticName;
+  return addItemToArray(object, item);
+}
+int
+aJsonClass::addItemToObjectOwned(aJsonObject *object, char *string,
+    aJsonObject *item)
+{
+  if (!item || !object || aJsonIsFrozen(item) || expand(object) == EOF)
+    return EOF;
+  aJsonFreeName(item);
+  item->name = string;
+  return addItemToArray(object, item);
+}
+int
+aJsonClass::setItemInObject(aJsonObject *object, const char *string,
+    aJsonObject *item)
+{
+  if (!item || !object || aJsonIsFrozen(item) || expand(object) == EOF)
+    return EOF;
+  aJsonObject *c = getObjectItem(object, string);
+  if (!c)
+    return addItemToObject(object, string, item);
+  //the old value goes with item
+  aJsonSwapValues(c, item);
+  deleteItem(item);
+  return 0;
+}
+int
+aJsonClass::addItemReferenceToArray(aJsonObject *array, aJsonObject *item)
+{
+  aJsonObject *reference = share(item);
+  if (addItemToArray(array, reference) == EOF)
+    {
+      deleteItem(reference);
+      return EOF;
+    }
+  return 0;
+}
+int
+aJsonClass::addItemReferenceToObject(aJsonObject *object, const char *string,
+    aJsonObject *item)
+{
+  aJsonObject *reference = share(item);
+  if (addItemToObject(object, string, reference) == EOF)
+    {
+      deleteItem(reference);
+      return EOF;
+    }
+  return 0;
+}
+
+aJsonObject*
+aJsonClass::detachItemFromArray(aJsonObject *array, unsigned char which)
+{
+  if (expand(array) == EOF)
+    return 0;
+  aJsonObject *c = array->child;
+  while (c && which > 0)
+    c = c->next, which--;
+  if (!c)
+    return 0;
+  if (c->prev)
     c->prev->next = c->next;
   if (c->next)
     c->next->prev = c->prev;
@@ -1028,248 +4277,1438 @@ aJsonClass::detachItemFromArray(aJsonObject *array, unsigned char which)
   return c;
 }
 void
-aJsonClass::deleteItemFromArray(aJsonObject *array, unsigned char which)
+aJsonClass::deleteItemFromArray(aJsonObject *array, unsigned char which)
+{
+  deleteItem(detachItemFromArray(array, which));
+}
+aJsonObject*
+aJsonClass::detachItemFromObject(aJsonObject *object, const char *string)
+{
+  if (expand(object) == EOF)
+    return 0;
+  unsigned char i = 0;
+  aJsonObject *c = object->child;
+  while (c && strcasecmp(c->name, string))
+    i++, c = c->next;
+  if (c)
+    return detachItemFromArray(object, i);
+  return 0;
+}
+void
+aJsonClass::deleteItemFromObject(aJsonObject *object, const char *string)
+{
+  deleteItem(detachItemFromObject(object, string));
+}
+
+// Insert an item into an array, the item at which moves up.
+int
+aJsonClass::insertItemInArray(aJsonObject *array, unsigned char which,
+    aJsonObject *newitem)
+{
+  if (!newitem || !array || aJsonIsFrozen(newitem) || expand(array) == EOF)
+    return EOF;
+  aJsonObject *c = array->child;
+  while (c && which > 0)
+    c = c->next, which--;
+  if (!c)
+    return addItemToArray(array, newitem);
+  newitem->next = c;
+  newitem->prev = c->prev;
+  c->prev = newitem;
+  if (c == array->child)
+    array->child = newitem;
+  else
+    newitem->prev->next = newitem;
+  return 0;
+}
+
+// Replace array/object items with new ones.
+int
+aJsonClass::replaceItemInArray(aJsonObject *array, unsigned char which,
+    aJsonObject *newitem)
+{
+  if (!newitem || aJsonIsFrozen(newitem))
+    return EOF;
+  aJsonObject *c = NULL;
+  if (array && expand(array) != EOF)
+    c = array->child;
+  while (c && which > 0)
+    c = c->next, which--;
+  if (!c)
+    return EOF;
+  newitem->next = c->next;
+  newitem->prev = c->prev;
+  if (newitem->next)
+    newitem->next->prev = newitem;
+  if (c == array->child)
+    array->child = newitem;
+  else
+    newitem->prev->next = newitem;
+  c->next = c->prev = 0;
+  deleteItem(c);
+  return 0;
+}
+int
+aJsonClass::replaceItemInObject(aJsonObject *object, const char *string,
+    aJsonObject *newitem)
+{
+  if (!newitem || aJsonIsFrozen(newitem))
+    return EOF;
+  unsigned char i = 0;
+  aJsonObject *c = NULL;
+  if (object && expand(object) != EOF)
+    c = object->child;
+  while (c && strcasecmp(c->name, string))
+    i++, c = c->next;
+  if (!c)
+    return EOF;
+  char *name = aJsonStrdup(string);
+  if (!name)
+    return EOF; // memory fail
+  aJsonFreeName(newitem);
+  newitem->name = name;
+  return replaceItemInArray(object, i, newitem);
+}
+
+// Create basic types:
+aJsonObject*
+aJsonClass::createNull()
+{
+  aJsonObject *item = newItem();
+  if (item)
+    item->type = aJson_NULL;
+  return item;
+}
+
+aJsonObject*
+aJsonClass::createItem(bool b)
+{
+  aJsonObject *item = newItem();
+  if (item){
+    item->type = aJson_Boolean;
+    item->valuebool = b;
+  }
+    
+  return item;
+}
+
+aJsonObject*
+aJsonClass::createItem(char b)
+{
+  aJsonObject *item = newItem();
+  if (item)
+    {
+      item->type = aJson_Boolean;
+      item->valuebool = b ? -1 : 0;
+    }
+  return item;
+}
+
+aJsonObject*
+aJsonClass::createItem(int num)
+{
+  aJsonObject *item = newItem();
+  if (item)
+    {
+      item->type = aJson_Int;
+      item->valueint = (int) num;
+    }
+  return item;
+}
+
+aJsonObject*
+aJsonClass::createItem(double num)
+{
+  aJsonObject *item = newItem();
+  if (item)
+    {
+      item->type = aJson_Float;
+      item->valuefloat = num;
+    }
+  return item;
+}
+
+aJsonObject*
+aJsonClass::createItem(const char *string)
+{
+  aJsonObject *item = newItem();
+  if (item)
+    {
+      item->type = aJson_String;
+      item->valuestring = aJsonStrdup(string);
+    }
+  return item;
+}
+
+aJsonObject*
+aJsonClass::createStringOwned(char *string)
+{
+  aJsonObject *item = newItem();
+  if (item)
+    {
+      item->type = aJson_String;
+      item->valuestring = string;
+    }
+  else
+    aJsonFreeString(string);
+  return item;
+}
+
+aJsonObject*
+aJsonClass::createArray()
+{
+  aJsonObject *item = newItem();
+  if (item)
+    item->type = aJson_Array;
+  return item;
+}
+aJsonObject*
+aJsonClass::createObject()
+{
+  aJsonObject *item = newItem();
+  if (item)
+    item->type = aJson_Object;
+  return item;
+}
+
+// Create Arrays:
+aJsonObject*
+aJsonClass::createIntArray(int *numbers, unsigned char count)
+{
+  aJsonObject *a = createArray();
+  if (!a || !count)
+    return a;
+  aJsonPacked *packed = aJsonNewPacked(aJson_Int, count);
+  if (!packed)
+    {
+      deleteItem(a);
+      return NULL;
+    }
+  memcpy(packed->ints, numbers, count * sizeof(int));
+  packed->count = count;
+  a->valuepacked = packed;
+  a->flags |= aJson_Packed;
+  return a;
+}
+
+aJsonObject*
+aJsonClass::createFloatArray(double *numbers, unsigned char count)
+{
+  aJsonObject *a = createArray();
+  if (!a || !count)
+    return a;
+  aJsonPacked *packed = aJsonNewPacked(aJson_Float, count);
+  if (!packed)
+    {
+      deleteItem(a);
+      return NULL;
+    }
+  memcpy(packed->floats, numbers, count * sizeof(double));
+  packed->count = count;
+  a->valuepacked = packed;
+  a->flags |= aJson_Packed;
+  return a;
+}
+
+aJsonObject*
+aJsonClass::createDoubleArray(double *numbers, unsigned char count)
+{
+  return createFloatArray(numbers, count);
+}
+
+aJsonObject*
+aJsonClass::createStringArray(const char **strings, unsigned char count)
+{
+  unsigned char i;
+  aJsonObject *n = 0, *p = 0, *a = createArray();
+  for (i = 0; a && i < count; i++)
+    {
+      n = createItem(strings[i]);
+      if (!i)
+        a->child = n;
+      else
+        suffixObject(p, n);
+      p = n;
+    }
+  return a;
+}
+
+// Copy an item, with recurse its children too.
+aJsonObject*
+aJsonClass::duplicate(aJsonObject *item, bool recurse)
+{
+  if (!item)
+    return NULL;
+  aJsonObject *copy = newItem();
+  if (!copy)
+    return NULL;
+  memcpy(copy, item, sizeof(aJsonObject));
+  copy->next = copy->prev = copy->child = NULL;
+  copy->name = NULL;
+  if (copy->flags & aJson_Shared)
+    copy->valueshare = NULL;
+  copy->flags &= ~(aJson_StaticName | aJson_Shared);
+  if (aJsonIsFrozen(copy))
+    copy->flags &= ~aJson_Frozen;
+  if (copy->type == aJson_String && item->valuestring)
+    {
+      copy->valuestring = aJsonStrdup(item->valuestring);
+      if (!copy->valuestring)
+        {
+          deleteItem(copy);
+          return NULL;
+        }
+    }
+  if (copy->flags & aJson_Raw)
+    {
+      copy->valueraw = aJsonCopyRaw(item->valueraw);
+      if (!copy->valueraw)
+        {
+          copy->flags &= ~aJson_Raw;
+          deleteItem(copy);
+          return NULL;
+        }
+    }
+  if (copy->flags & aJson_Packed)
+    {
+      copy->valuepacked = aJsonCopyPacked(item->valuepacked,
+          item->valuepacked->type, item->valuepacked->count);
+      if (!copy->valuepacked)
+        {
+          copy->flags &= ~aJson_Packed;
+          deleteItem(copy);
+          return NULL;
+        }
+    }
+  if (item->name)
+    {
+      copy->name = aJsonStrdup(item->name);
+      if (!copy->name)
+        {
+          deleteItem(copy);
+          return NULL;
+        }
+    }
+  if (!recurse)
+    return copy;
+  aJsonObject *p = NULL;
+  for (aJsonObject *c = item->child; c; c = c->next)
+    {
+      aJsonObject *n = duplicate(c, true);
+      if (!n)
+        {
+          deleteItem(copy);
+          return NULL;
+        }
+      if (p)
+        suffixObject(p, n);
+      else
+        copy->child = n;
+      p = n;
+    }
+  return copy;
+}
+
+void
+aJsonClass::addNullToObject(aJsonObject* object, const char* name)
+{
+  aJsonObject *item = createNull();
+  if (addItemToObject(object, name, item) == EOF)
+    deleteItem(item);
+}
+
+void
+aJsonClass::addBooleanToObject(aJsonObject* object, const char* name, bool b)
+{
+  aJsonObject *item = createItem(b);
+  if (addItemToObject(object, name, item) == EOF)
+    deleteItem(item);
+}
+
+void
+aJsonClass::addNumberToObject(aJsonObject* object, const char* name, int n)
+{
+  aJsonObject *item = createItem(n);
+  if (addItemToObject(object, name, item) == EOF)
+    deleteItem(item);
+}
+
+void
+aJsonClass::addNumberToObject(aJsonObject* object, const char* name, double n)
+{
+  aJsonObject *item = createItem(n);
+  if (addItemToObject(object, name, item) == EOF)
+    deleteItem(item);
+}
+
+void
+aJsonClass::addStringToObject(aJsonObject* object, const char* name,
+    const char* s)
+{
+  aJsonObject *item = createItem(s);
+  if (addItemToObject(object, name, item) == EOF)
+    deleteItem(item);
+}
+
+// Whether the numbers of packed are the items of list, without unpacking.
+static bool
+aJsonPackedEquals(aJsonPacked *packed, aJsonObject *list)
+{
+  for (unsigned char i = 0; i < packed->count; i++, list = list->next)
+    {
+      if (!list || list->type != packed->type)
+        return false;
+      if (packed->type == aJson_Int ? aJson.getInt(list) != packed->ints[i]
+          : aJson.getFloat(list) != packed->floats[i])
+        return false;
+    }
+  return list == NULL;
+}
+
+// Deep comparison of two values, object members are paired up by name like
+// getObjectItem() finds them, the n-th of a name with the n-th of b. Nothing is
+// unpacked or copied, only lazy parts get parsed.
+bool
+aJsonClass::equals(aJsonObject *a, aJsonObject *b)
+{
+  if (a == b)
+    return true;
+  if (!a || !b)
+    return false;
+  char type = a->type;
+  if (type != b->type)
+    return false;
+  switch (type)
+    {
+  case aJson_NULL:
+    return true;
+  case aJson_Boolean:
+    return !a->valuebool == !b->valuebool;
+  case aJson_Int:
+    return getInt(a) == getInt(b);
+  case aJson_Float:
+    return getFloat(a) == getFloat(b);
+  case aJson_String:
+    if (!a->valuestring || !b->valuestring)
+      return a->valuestring == b->valuestring;
+    return !strcmp(a->valuestring, b->valuestring);
+  case aJson_Array:
+    {
+      if (materialize(a) == EOF || materialize(b) == EOF)
+        return false;
+      //packed numbers are compared without unpacking them
+      if (a->flags & b->flags & aJson_Packed)
+        {
+          aJsonPacked *pa = a->valuepacked, *pb = b->valuepacked;
+          if (pa->type != pb->type || pa->count != pb->count)
+            return false;
+          for (unsigned char i = 0; i < pa->count; i++)
+            if (pa->type == aJson_Int ? pa->ints[i] != pb->ints[i]
+                : pa->floats[i] != pb->floats[i])
+              return false;
+          return true;
+        }
+      if (a->flags & aJson_Packed)
+        return aJsonPackedEquals(a->valuepacked, b->child);
+      if (b->flags & aJson_Packed)
+        return aJsonPackedEquals(b->valuepacked, a->child);
+      aJsonObject *ca = a->child, *cb = b->child;
+      while (ca && cb)
+        {
+          if (!equals(ca, cb))
+            return false;
+          ca = ca->next, cb = cb->next;
+        }
+      return ca == cb;
+    }
+  case aJson_Object:
+    {
+      if (materialize(a) == EOF || materialize(b) == EOF)
+        return false;
+      aJsonObject *ca = a->child, *cb = b->child;
+      while (ca && cb)
+        ca = ca->next, cb = cb->next;
+      if (ca || cb)
+        return false; // not as many members
+      //the n-th member of a with some name goes with the n-th one of b
+      for (ca = a->child; ca; ca = ca->next)
+        {
+          if (!ca->name)
+            return false;
+          unsigned int n = 0;
+          for (aJsonObject *c = a->child; c != ca; c = c->next)
+            if (c->name && !strcasecmp(c->name, ca->name))
+              n++;
+          for (cb = b->child; cb; cb = cb->next)
+            if (cb->name && !strcasecmp(cb->name, ca->name) && n-- == 0)
+              break;
+          if (!equals(ca, cb))
+            return false;
+        }
+      return true;
+    }
+    }
+  return false;
+}
+
+// FNV-1a over length bytes, going on from hash.
+static uint64_t
+aJsonHashBytes(uint64_t hash, const void *data, size_t length)
+{
+  const unsigned char *bytes = (const unsigned char *) data;
+  for (size_t i = 0; i < length; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ULL;
+    }
+  return hash;
+}
+
+// Scramble the hash of an object member before it is added up with the
+// others, so that similar members do not cancel out.
+static uint64_t
+aJsonHashMix(uint64_t hash)
+{
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+uint64_t
+aJsonClass::hash(aJsonObject *item)
+{
+  uint64_t result = 0xcbf29ce484222325ULL;
+  if (item == NULL)
+    {
+      return result;
+    }
+  char type = item->type;
+  result = aJsonHashBytes(result, &type, 1);
+  switch (type)
+    {
+  case aJson_Boolean:
+    {
+      char value = item->valuebool ? 1 : 0;
+      return aJsonHashBytes(result, &value, 1);
+    }
+  case aJson_Int:
+    {
+      //the same on every platform, whatever the size of an int
+      long number = getInt(item);
+      unsigned char bytes[4];
+      for (unsigned char i = 0; i < 4; i++)
+        bytes[i] = (unsigned char) (number >> (8 * i));
+      return aJsonHashBytes(result, bytes, 4);
+    }
+  case aJson_Float:
+    {
+      double number = getFloat(item);
+      if (number == 0)
+        number = 0; // -0 equals 0
+      return aJsonHashBytes(result, &number, sizeof(number));
+    }
+  case aJson_String:
+    if (item->valuestring)
+      return aJsonHashBytes(result, item->valuestring, strlen(item->valuestring));
+    return result;
+  case aJson_Array:
+    {
+      if (materialize(item) == EOF)
+        return result;
+      if (item->flags & aJson_Packed)
+        {
+          //hash the numbers like the items they stand for
+          aJsonPacked *packed = item->valuepacked;
+          aJsonObject number;
+          number.type = packed->type;
+          number.flags = 0;
+          for (unsigned char i = 0; i < packed->count; i++)
+            {
+              if (packed->type == aJson_Int)
+                number.valueint = packed->ints[i];
+              else
+                number.valuefloat = packed->floats[i];
+              uint64_t member = hash(&number);
+              result = aJsonHashBytes(result, &member, sizeof(member));
+            }
+          return result;
+        }
+      for (aJsonObject *child = item->child; child; child = child->next)
+        {
+          uint64_t member = hash(child);
+          result = aJsonHashBytes(result, &member, sizeof(member));
+        }
+      return result;
+    }
+  case aJson_Object:
+    {
+      if (materialize(item) == EOF)
+        return result;
+      //members may come in any order, so they are added up
+      uint64_t sum = 0;
+      for (aJsonObject *child = item->child; child; child = child->next)
+        {
+          uint64_t member = hash(child);
+          for (const char *name = child->name; name && *name; name++)
+            {
+              char lower = tolower(*name);
+              member = aJsonHashBytes(member, &lower, 1);
+            }
+          sum += aJsonHashMix(member);
+        }
+      return aJsonHashBytes(result, &sum, sizeof(sum));
+    }
+    }
+  return result;
+}
+
+int
+aJsonClass::printCanonical(aJsonObject *item, aJsonStream* stream)
+{
+  return stream->printCanonical(item);
+}
+
+// Append a JSON Pointer segment to path, escaping '~' and '/'.
+// Returns the new length or 0 if it does not fit.
+static size_t
+aJsonAppendSegment(char *path, size_t length, const char *key)
+{
+  if (length + 1 >= PATCH_PATH_LEN)
+    return 0;
+  path[length++] = '/';
+  for (; *key; key++)
+    {
+      char escaped = (*key == '~') ? '0' : (*key == '/') ? '1' : 0;
+      if (length + (escaped ? 2 : 1) >= PATCH_PATH_LEN)
+        return 0;
+      if (escaped)
+        {
+          path[length++] = '~';
+          path[length++] = escaped;
+        }
+      else
+        path[length++] = *key;
+    }
+  path[length] = 0;
+  return length;
+}
+
+// Add item to object under name, deleting item if that fails.
+static int
+aJsonAddMember(aJsonObject *object, const char *name, aJsonObject *item)
+{
+  if (aJson.addItemToObject(object, name, item) == EOF)
+    {
+      aJson.deleteItem(item);
+      return EOF;
+    }
+  return 0;
+}
+
+// Append {"op":op,"path":path,"value":value} to patch, taking over value. Only
+// remove comes without a value. Nothing is appended if memory runs out.
+int
+aJsonClass::addPatchOperation(aJsonObject *patch, const char *op,
+    const char *path, aJsonObject *value)
+{
+  int result = EOF;
+  aJsonObject *operation = NULL;
+  if (value || !strcmp(op, "remove"))
+    operation = createObject();
+  if (operation && aJsonAddMember(operation, "op", createItem(op)) == 0
+      && aJsonAddMember(operation, "path", createItem(path)) == 0)
+    {
+      result = value ? aJsonAddMember(operation, "value", value) : 0;
+      value = NULL; // operation has it now, or it is gone
+      if (result == 0)
+        result = addItemToArray(patch, operation);
+    }
+  if (result == EOF)
+    {
+      deleteItem(operation);
+      deleteItem(value);
+    }
+  return result;
+}
+
+// Emit the operations turning from into to, both living at path.
+int
+aJsonClass::diffItems(aJsonObject *from, aJsonObject *to, char *path,
+    size_t length, aJsonObject *patch)
+{
+  char type = from->type;
+  if (type != to->type
+      || (type != aJson_Object && type != aJson_Array))
+    {
+      //values only, nothing to go into
+      if (equals(from, to))
+        return 0;
+    }
+  else if (expand(from, false) == 0 && expand(to, false) == 0)
+    {
+      //a child path that does not fit makes us replace the whole container
+      char index[4];
+      aJsonObject *f, *t;
+      unsigned char i = 0;
+      for (f = from->child; f; f = f->next, i++)
+        {
+          if (type == aJson_Array)
+            {
+              snprintf(index, sizeof(index), "%u", i);
+              if (!aJsonAppendSegment(path, length, index))
+                break;
+            }
+          else if (!f->name || !aJsonAppendSegment(path, length, f->name))
+            break;
+        }
+      for (t = to->child; !f && t; t = t->next)
+        if (type == aJson_Object && (!t->name
+            || !aJsonAppendSegment(path, length, t->name)))
+          break;
+      if (!f && !t)
+        {
+          int result = (type == aJson_Object)
+              ? diffMembers(from, to, path, length, patch)
+              : diffElements(from, to, path, length, patch);
+          path[length] = 0;
+          return result;
+        }
+      path[length] = 0;
+      if (equals(from, to))
+        return 0;
+    }
+  aJsonObject *value = duplicate(to);
+  if (!value)
+    return EOF;
+  return addPatchOperation(patch, "replace", path, value);
+}
+
+// Diff the members of two objects whose names all fit into path.
+int
+aJsonClass::diffMembers(aJsonObject *from, aJsonObject *to, char *path,
+    size_t length, aJsonObject *patch)
+{
+  aJsonObject *f, *t;
+  for (f = from->child; f; f = f->next)
+    {
+      size_t child_length = aJsonAppendSegment(path, length, f->name);
+      t = aJsonFindMember(to, f->name);
+      if ((t ? diffItems(f, t, path, child_length, patch)
+          : addPatchOperation(patch, "remove", path, NULL)) == EOF)
+        return EOF;
+    }
+  for (t = to->child; t; t = t->next)
+    {
+      if (aJsonFindMember(from, t->name))
+        continue;
+      aJsonAppendSegment(path, length, t->name);
+      if (addPatchOperation(patch, "add", path, duplicate(t)) == EOF)
+        return EOF;
+    }
+  return 0;
+}
+
+// Diff the elements of two arrays. If the sizes differ the equal elements at
+// both ends are left alone, so that inserting or removing some in between
+// does not replace everything behind them.
+int
+aJsonClass::diffElements(aJsonObject *from, aJsonObject *to, char *path,
+    size_t length, aJsonObject *patch)
+{
+  char index[4];
+  aJsonObject *f = from->child, *t = to->child;
+  unsigned char from_size = getArraySize(from), to_size = getArraySize(to);
+  unsigned char i = 0;
+  if (from_size != to_size)
+    {
+      while (f && t && equals(f, t))
+        f = f->next, t = t->next, i++;
+      //then the equal ones at the end, which are not diffed at all
+      aJsonObject *f_end = f, *t_end = t;
+      while (f_end && f_end->next)
+        f_end = f_end->next;
+      while (t_end && t_end->next)
+        t_end = t_end->next;
+      while (from_size > i && to_size > i && equals(f_end, t_end))
+        f_end = f_end->prev, t_end = t_end->prev, from_size--, to_size--;
+    }
+  //pairwise for the common part, then grow or shrink at its end
+  for (; i < from_size && i < to_size; f = f->next, t = t->next, i++)
+    {
+      snprintf(index, sizeof(index), "%u", i);
+      size_t child_length = aJsonAppendSegment(path, length, index);
+      if (diffItems(f, t, path, child_length, patch) == EOF)
+        return EOF;
+    }
+  for (; i < to_size; t = t->next, i++)
+    {
+      snprintf(index, sizeof(index), "%u", i);
+      aJsonAppendSegment(path, length, index);
+      if (addPatchOperation(patch, "add", path, duplicate(t)) == EOF)
+        return EOF;
+    }
+  snprintf(index, sizeof(index), "%u", i);
+  aJsonAppendSegment(path, length, index);
+  for (; from_size > i; from_size--)
+    {
+      //everything behind moves up, so it is always the same index
+      if (addPatchOperation(patch, "remove", path, NULL) == EOF)
+        return EOF;
+    }
+  return 0;
+}
+
+aJsonObject*
+aJsonClass::diff(aJsonObject *from, aJsonObject *to)
+{
+  if (!from || !to)
+    return NULL;
+  aJsonObject *patch = createArray();
+  if (!patch)
+    return NULL;
+  char path[PATCH_PATH_LEN];
+  path[0] = 0;
+  if (diffItems(from, to, path, 0, patch) == EOF)
+    {
+      deleteItem(patch);
+      return NULL;
+    }
+  return patch;
+}
+
+// Put value at path: replace the root, set an object member or insert into an array.
+int
+aJsonClass::addPathItem(aJsonObject *root, aJsonPath *path, aJsonObject *value)
+{
+  if (path->count == 0)
+    {
+      aJsonSwapValues(root, value);
+      deleteItem(value);
+      return 0;
+    }
+  aJsonObject *parent = walkPath(root, path, 0, path->count - 1, true);
+  const aJsonPathSegment *segment = &path->segments[path->count - 1];
+  if (parent && parent->type == aJson_Object && expand(parent) == 0)
+    {
+      aJsonObject *c = aJsonFindMember(parent, segment->key);
+      if (!c)
+        {
+          if (addItemToObject(parent, segment->key, value) == 0)
+            return 0;
+        }
+      else
+        {
+          //the old value goes with value
+          aJsonSwapValues(c, value);
+          deleteItem(value);
+          return 0;
+        }
+    }
+  else if (parent && parent->type == aJson_Array)
+    {
+      aJsonFreeName(value);
+      if (!strcmp(segment->key, "-"))
+        {
+          if (addItemToArray(parent, value) == 0)
+            return 0;
+        }
+      else if (segment->index >= 0 && segment->index <= getArraySize(parent)
+          && insertItemInArray(parent, (unsigned char) segment->index, value) == 0)
+        return 0;
+    }
+  deleteItem(value);
+  return EOF;
+}
+
+// Detach the item a path points to from its parent.
+aJsonObject*
+aJsonClass::detachPathItem(aJsonObject *root, aJsonPath *path)
+{
+  if (path->count == 0)
+    return NULL; // the root has no parent
+  aJsonObject *parent = walkPath(root, path, 0, path->count - 1, true);
+  const aJsonPathSegment *segment = &path->segments[path->count - 1];
+  if (parent && parent->type == aJson_Array)
+    {
+      if (segment->index < 0 || segment->index > 255)
+        return NULL;
+      return detachItemFromArray(parent, (unsigned char) segment->index);
+    }
+  if (parent && parent->type == aJson_Object && expand(parent) == 0)
+    {
+      unsigned char i = 0;
+      aJsonObject *c = parent->child;
+      while (c && strcmp(c->name, segment->key))
+        i++, c = c->next;
+      if (c)
+        return detachItemFromArray(parent, i);
+    }
+  return NULL;
+}
+
+// Apply a single patch operation.
+int
+aJsonClass::applyOperation(aJsonObject *root, aJsonObject *operation)
+{
+  aJsonObject *op = getObjectItem(operation, "op");
+  aJsonObject *path_item = getObjectItem(operation, "path");
+  aJsonObject *from_item = getObjectItem(operation, "from");
+  if (!op || op->type != aJson_String || !path_item
+      || path_item->type != aJson_String)
+    return EOF;
+  const char *path_string = path_item->valuestring;
+  const char *from_string = (from_item && from_item->type == aJson_String) ?
+      from_item->valuestring : NULL;
+  //only JSON Pointers, no dotted paths
+  if ((path_string[0] && path_string[0] != '/')
+      || (from_string && from_string[0] && from_string[0] != '/'))
+    return EOF;
+  aJsonPath *path = compilePath(path_string);
+  if (!path)
+    return EOF;
+  int result = EOF;
+  aJsonObject *value = NULL;
+  if (!strcmp(op->valuestring, "test"))
+    {
+      result = equals(walkPath(root, path, 0, path->count),
+          getObjectItem(operation, "value")) ? 0 : EOF;
+    }
+  else if (!strcmp(op->valuestring, "add"))
+    {
+      value = detachItemFromObject(operation, "value");
+      if (value)
+        result = addPathItem(root, path, value);
+    }
+  else if (!strcmp(op->valuestring, "replace"))
+    {
+      aJsonObject *parent = path->count ?
+          walkPath(root, path, 0, path->count - 1, true) : NULL;
+      if (walkPath(root, path, 0, path->count)
+          && (value = detachItemFromObject(operation, "value")))
+        {
+          if (parent && parent->type == aJson_Array)
+            {
+              //replace must not shift the array like add does
+              aJsonFreeName(value);
+              result = replaceItemInArray(parent,
+                  (unsigned char) path->segments[path->count - 1].index, value);
+              if (result == EOF)
+                deleteItem(value);
+            }
+          else
+            result = addPathItem(root, path, value);
+        }
+    }
+  else if (!strcmp(op->valuestring, "remove"))
+    {
+      value = detachPathItem(root, path);
+      if (value)
+        {
+          deleteItem(value);
+          result = 0;
+        }
+    }
+  else if (from_string && (!strcmp(op->valuestring, "move")
+      || !strcmp(op->valuestring, "copy")))
+    {
+      size_t from_length = strlen(from_string);
+      aJsonPath *from = compilePath(from_string);
+      if (!strcmp(op->valuestring, "copy"))
+        value = from ? duplicate(walkPath(root, from, 0, from->count)) : NULL;
+      else if (from && !strcmp(path_string, from_string))
+        result = walkPath(root, from, 0, from->count) ? 0 : EOF; // stays where it is
+      else if (from && (strncmp(path_string, from_string, from_length)
+          || (path_string[from_length] && path_string[from_length] != '/')))
+        value = detachPathItem(root, from); // not into one of its own children
+      if (value)
+        result = addPathItem(root, path, value);
+      deletePath(from);
+    }
+  deletePath(path);
+  return result;
+}
+
+int
+aJsonClass::applyPatch(aJsonObject *root, aJsonObject *patch)
+{
+  if (!root || !patch || patch->type != aJson_Array || expand(patch) == EOF)
+    return EOF;
+  for (aJsonObject *operation = patch->child; operation;
+      operation = operation->next)
+    {
+      if (operation->type != aJson_Object || applyOperation(root, operation) == EOF)
+        return EOF;
+    }
+  return 0;
+}
+
+int
+aJsonClass::mergePatch(aJsonObject *target, aJsonObject *patch)
+{
+  if (!target || !patch || aJsonIsFrozen(target) || aJsonIsFrozen(patch))
+    return EOF;
+  if (patch->type != aJson_Object)
+    {
+      //anything but an object simply replaces the target
+      aJsonSwapValues(target, patch);
+      return 0;
+    }
+  if (target->type != aJson_Object)
+    {
+      deleteValue(target);
+      target->type = aJson_Object;
+    }
+  if (expand(target) == EOF || expand(patch) == EOF)
+    return EOF;
+  aJsonObject *p = patch->child, *next;
+  for (; p; p = next)
+    {
+      next = p->next;
+      if (!p->name)
+        continue;
+      //patch keys mind case (RFC 7386)
+      aJsonObject *t = aJsonFindMember(target, p->name);
+      if (p->type == aJson_NULL)
+        {
+          if (t)
+            {
+              aJsonUnlink(target, t);
+              deleteItem(t);
+            }
+        }
+      else if (p->type == aJson_Object)
+        {
+          if (!t)
+            {
+              t = createObject();
+              if (!t || addItemToObject(target, p->name, t) == EOF)
+                {
+                  deleteItem(t);
+                  return EOF;
+                }
+            }
+          if (mergePatch(t, p) == EOF)
+            return EOF;
+        }
+      else if (t)
+        {
+          //keep the node, just take over the new value
+          aJsonSwapValues(t, p);
+        }
+      else
+        {
+          //move it over with the name it already has
+          aJsonUnlink(patch, p);
+          if (addItemToArray(target, p) == EOF)
+            {
+              deleteItem(p);
+              return EOF;
+            }
+        }
+    }
+  return 0;
+}
+
+int
+aJsonClass::mergePatch(aJsonObject *target, aJsonStream *stream)
+{
+  if (!target || !stream || aJsonIsFrozen(target))
+    return EOF;
+  aJsonAllocatorScope scope(stream->getAllocator());
+  stream->skip();
+  return stream->parseMergePatch(target);
+}
+
+int
+aJsonClass::parseStruct(aJsonStream *stream, void *target,
+    const aJsonField *fields, unsigned char count)
+{
+  if (!stream || !target)
+    return EOF;
+  return stream->parseStruct(target, fields, count);
+}
+
+int
+aJsonClass::printStruct(aJsonStream *stream, const void *source,
+    const aJsonField *fields, unsigned char count)
+{
+  if (!stream || !source)
+    return EOF;
+  return stream->printStruct(source, fields, count);
+}
+
+void
+aJsonClass::setAllocator(const aJsonAllocator *allocator)
 {
-  deleteItem(detachItemFromArray(array, which));
+  aJsonUseAllocator(allocator);
 }
-aJsonObject*
-aJsonClass::detachItemFromObject(aJsonObject *object, const char *string)
+
+void
+aJsonClass::setNodePool(aJsonNodePool *pool)
 {
-  unsigned char i = 0;
-  aJsonObject *c = object->child;
-  while (c && strcasecmp(c->name, string))
-    i++, c = c->next;
-  if (c)
-    return detachItemFromArray(object, i);
-  return 0;
+  aJsonUseNodePool(pool);
 }
+
 void
-aJsonClass::deleteItemFromObject(aJsonObject *object, const char *string)
+aJsonClass::getMemoryStats(aJsonMemoryStats *stats)
 {
-  deleteItem(detachItemFromObject(object, string));
+  aJsonGetMemoryStats(stats);
 }
 
-// Replace array/object items with new ones.
 void
-aJsonClass::replaceItemInArray(aJsonObject *array, unsigned char which,
-    aJsonObject *newitem)
+aJsonClass::resetMemoryStats()
 {
-  aJsonObject *c = array->child;
-  while (c && which > 0)
-    c = c->next, which--;
-  if (!c)
-    return;
-  newitem->next = c->next;
-  newitem->prev = c->prev;
-  if (newitem->next)
-    newitem->next->prev = newitem;
-  if (c == array->child)
-    array->child = newitem;
-  else
-    newitem->prev->next = newitem;
-  c->next = c->prev = 0;
-  deleteItem(c);
+  aJsonResetMemoryStats();
 }
+
+// Add up the nodes and strings of an item and its children.
 void
-aJsonClass::replaceItemInObject(aJsonObject *object, const char *string,
-    aJsonObject *newitem)
+aJsonClass::measure(aJsonObject *item, aJsonMemoryStats *stats)
 {
-  unsigned char i = 0;
-  aJsonObject *c = object->child;
-  while (c && strcasecmp(c->name, string))
-    i++, c = c->next;
-  if (c)
+  memset(stats, 0, sizeof(aJsonMemoryStats));
+  measureItem(item, stats);
+  stats->peak = stats->bytes;
+}
+
+void
+aJsonClass::measureItem(aJsonObject *item, aJsonMemoryStats *stats)
+{
+  if (!item)
+    return;
+  stats->nodes++;
+  stats->allocations++;
+  stats->bytes += sizeof(aJsonObject);
+  if (item->flags & aJson_Packed)
+    {
+      stats->allocations++;
+      stats->bytes += aJsonPackedSize(item->valuepacked->type,
+          item->valuepacked->capacity);
+    }
+  if (item->flags & aJson_Raw)
+    {
+      stats->allocations++;
+      stats->bytes += sizeof(aJsonRaw) + strlen(item->valueraw->text) + 1;
+    }
+  if (item->name && !(item->flags & aJson_StaticName))
+    {
+      stats->allocations++;
+      stats->bytes += strlen(item->name) + 1;
+    }
+  if (item->flags & aJson_Shared)
+    {
+      stats->allocations++;
+      stats->bytes += sizeof(aJsonShare);
+    }
+  if (item->type == aJson_String && item->valuestring)
     {
-      newitem->name = strdup(string);
-      replaceItemInArray(object, i, newitem);
+      stats->allocations++;
+      stats->bytes += strlen(item->valuestring) + 1;
     }
+  for (aJsonObject *c = item->child; c; c = c->next)
+    measureItem(c, stats);
 }
 
-// Create basic types:
-aJsonObject*
-aJsonClass::createNull()
+int
+aJsonClass::freeze(aJsonObject *item)
 {
-  aJsonObject *item = newItem();
-  if (item)
-    item->type = aJson_NULL;
-  return item;
+  if (!item || aJsonIsFrozen(item))
+    return 0;
+  char type = item->type;
+  if (type == aJson_Array || type == aJson_Object)
+    {
+      //readers must never have to parse, unpack or copy anything
+      if (expand(item) == EOF)
+        return EOF;
+      for (aJsonObject *c = item->child; c; c = c->next)
+        if (freeze(c) == EOF)
+          return EOF;
+    }
+  else if (item->flags & aJson_Raw)
+    {
+      //convert it now, it is only cached on first use
+      getFloat(item);
+    }
+  item->flags |= aJson_Frozen;
+  return 0;
 }
 
-aJsonObject*
-aJsonClass::createItem(bool b)
+bool
+aJsonClass::isFrozen(aJsonObject *item)
 {
-  aJsonObject *item = newItem();
-  if (item){
-    item->type = aJson_Boolean;
-    item->valuebool = b;
-  }
-    
-  return item;
+  return aJsonIsFrozen(item);
 }
 
-aJsonObject*
-aJsonClass::createItem(char b)
+// Counters shared with interrupts or other threads.
+static void
+aJsonAtomicAdd(volatile unsigned int *counter, int delta)
 {
-  aJsonObject *item = newItem();
-  if (item)
+#ifdef __AVR__
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-      item->type = aJson_Boolean;
-      item->valuebool = b ? -1 : 0;
+      *counter += delta;
     }
-  return item;
+#else
+  __atomic_add_fetch(counter, delta, __ATOMIC_SEQ_CST);
+#endif
 }
 
-aJsonObject*
-aJsonClass::createItem(int num)
+static unsigned int
+aJsonAtomicGet(volatile unsigned int *counter)
 {
-  aJsonObject *item = newItem();
-  if (item)
+#ifdef __AVR__
+  unsigned int value;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-      item->type = aJson_Int;
-      item->valueint = (int) num;
+      value = *counter;
     }
-  return item;
+  return value;
+#else
+  return __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+#endif
 }
 
-aJsonObject*
-aJsonClass::createItem(double num)
+// A single byte is read and written in one go everywhere, the builtins
+// just keep the compiler and the CPU from reordering around it.
+static unsigned char
+aJsonAtomicGetSlot(volatile unsigned char *slot)
 {
-  aJsonObject *item = newItem();
-  if (item)
-    {
-      item->type = aJson_Float;
-      item->valuefloat = num;
-    }
-  return item;
+#ifdef __AVR__
+  return *slot;
+#else
+  return __atomic_load_n(slot, __ATOMIC_SEQ_CST);
+#endif
 }
 
-aJsonObject*
-aJsonClass::createItem(const char *string)
+static void
+aJsonAtomicSetSlot(volatile unsigned char *slot, unsigned char value)
 {
-  aJsonObject *item = newItem();
-  if (item)
+#ifdef __AVR__
+  *slot = value;
+#else
+  __atomic_store_n(slot, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static aJsonObject*
+aJsonAtomicGetItem(aJsonObject *volatile *item)
+{
+#ifdef __AVR__
+  aJsonObject *value;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-      item->type = aJson_String;
-      item->valuestring = strdup(string);
+      value = *item;
     }
-  return item;
+  return value;
+#else
+  return __atomic_load_n(item, __ATOMIC_SEQ_CST);
+#endif
 }
 
-aJsonObject*
-aJsonClass::createArray()
+static void
+aJsonAtomicSetItem(aJsonObject *volatile *item, aJsonObject *value)
 {
-  aJsonObject *item = newItem();
-  if (item)
-    item->type = aJson_Array;
-  return item;
+#ifdef __AVR__
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      *item = value;
+    }
+#else
+  __atomic_store_n(item, value, __ATOMIC_SEQ_CST);
+#endif
 }
-aJsonObject*
-aJsonClass::createObject()
+
+aJsonPublisher::aJsonPublisher()
+  : current(0)
 {
-  aJsonObject *item = newItem();
-  if (item)
-    item->type = aJson_Object;
-  return item;
+  for (unsigned char i = 0; i < PUBLISHER_VERSIONS; i++)
+    {
+      versions[i] = NULL;
+      readers[i] = 0;
+    }
 }
 
-// Create Arrays:
 aJsonObject*
-aJsonClass::createIntArray(int *numbers, unsigned char count)
+aJsonPublisher::acquire()
 {
-  unsigned char i;
-  aJsonObject *n = 0, *p = 0, *a = createArray();
-  for (i = 0; a && i < count; i++)
+  for (;;)
     {
-      n = createItem(numbers[i]);
-      if (!i)
-        a->child = n;
-      else
-        suffixObject(p, n);
-      p = n;
+      unsigned char slot = aJsonAtomicGetSlot(&current);
+      aJsonAtomicAdd(&readers[slot], 1);
+      //if it is still current, publish() has not deleted it and will not
+      if (aJsonAtomicGetSlot(&current) == slot)
+        {
+          aJsonObject *document = aJsonAtomicGetItem(&versions[slot]);
+          if (document == NULL)
+            aJsonAtomicAdd(&readers[slot], -1);
+          return document;
+        }
+      aJsonAtomicAdd(&readers[slot], -1);
     }
-  return a;
 }
 
-aJsonObject*
-aJsonClass::createFloatArray(double *numbers, unsigned char count)
+void
+aJsonPublisher::release(aJsonObject *document)
 {
-  unsigned char i;
-  aJsonObject *n = 0, *p = 0, *a = createArray();
-  for (i = 0; a && i < count; i++)
+  for (unsigned char i = 0; document && i < PUBLISHER_VERSIONS; i++)
     {
-      n = createItem(numbers[i]);
-      if (!i)
-        a->child = n;
-      else
-        suffixObject(p, n);
-      p = n;
+      if (aJsonAtomicGetItem(&versions[i]) == document)
+        {
+          aJsonAtomicAdd(&readers[i], -1);
+          return;
+        }
     }
-  return a;
 }
 
-aJsonObject*
-aJsonClass::createDoubleArray(double *numbers, unsigned char count)
+int
+aJsonPublisher::publish(aJsonObject *document)
 {
-  unsigned char i;
-  aJsonObject *n = 0, *p = 0, *a = createArray();
-  for (i = 0; a && i < count; i++)
+  if (!document || aJson.freeze(document) == EOF)
+    return EOF;
+  this->reclaim();
+  unsigned char slot = current;
+  for (unsigned char i = 0; i < PUBLISHER_VERSIONS; i++)
     {
-      n = createItem(numbers[i]);
-      if (!i)
-        a->child = n;
-      else
-        suffixObject(p, n);
-      p = n;
+      if (versions[i] == NULL && i != current)
+        {
+          slot = i;
+          break;
+        }
     }
-  return a;
+  if (slot == current && versions[slot] != NULL)
+    return EOF; // every old version is still being read
+  aJsonAtomicSetItem(&versions[slot], document);
+  aJsonAtomicSetSlot(&current, slot);
+  this->reclaim();
+  return 0;
 }
 
-aJsonObject*
-aJsonClass::createStringArray(const char **strings, unsigned char count)
+unsigned char
+aJsonPublisher::reclaim()
 {
-  unsigned char i;
-  aJsonObject *n = 0, *p = 0, *a = createArray();
-  for (i = 0; a && i < count; i++)
+  unsigned char left = 0;
+  for (unsigned char i = 0; i < PUBLISHER_VERSIONS; i++)
     {
-      n = createItem(strings[i]);
-      if (!i)
-        a->child = n;
+      if (i == current || versions[i] == NULL)
+        continue;
+      if (aJsonAtomicGet(&readers[i]) == 0)
+        {
+          aJsonObject *document = versions[i];
+          aJsonAtomicSetItem(&versions[i], NULL);
+          aJson.deleteItem(document);
+        }
       else
-        suffixObject(p, n);
-      p = n;
+        left++;
     }
-  return a;
+  return left;
 }
 
 void
-aJsonClass::addNullToObject(aJsonObject* object, const char* name)
+aJsonClass::setParseCache(aJsonParseCache *cache)
 {
-  addItemToObject(object, name, createNull());
+  aJsonActiveCache = cache;
 }
 
-void
-aJsonClass::addBooleanToObject(aJsonObject* object, const char* name, bool b)
+aJsonParseCache::aJsonParseCache(aJsonCacheEntry *entries_,
+    unsigned char count_)
+  : entries(entries_), count(count_), clock(0), hits(0), misses(0)
 {
-  addItemToObject(object, name, createItem(b));
+  memset(entries, 0, count * sizeof(aJsonCacheEntry));
 }
 
-void
-aJsonClass::addNumberToObject(aJsonObject* object, const char* name, int n)
+aJsonObject*
+aJsonParseCache::parse(char *json)
+{
+  size_t length = strlen(json);
+  uint64_t hash = aJsonHashBytes(0xcbf29ce484222325ULL, json, length);
+  aJsonCacheEntry *victim = NULL;
+  for (unsigned char i = 0; i < count; i++)
+    {
+      aJsonCacheEntry *entry = &entries[i];
+      if (entry->item != NULL && entry->hash == hash
+          && entry->length == length && !memcmp(entry->text, json, length)
+          && entry->users < 255)
+        {
+          hits++;
+          entry->users++;
+          entry->used = ++clock;
+          return entry->item;
+        }
+      //a free entry, else the least recently used one nobody holds
+      if (entry->users == 0 && (victim == NULL || (victim->item != NULL
+          && (entry->item == NULL || entry->used < victim->used))))
+        {
+          victim = entry;
+        }
+    }
+  misses++;
+  aJsonStringStream stream(json, NULL, 0, length);
+  aJsonObject *item = aJson.parse(&stream);
+  if (item != NULL && aJson.freeze(item) == EOF)
+    {
+      return item; // partly frozen, not kept
+    }
+  if (item == NULL || victim == NULL)
+    {
+      return item; // every tree is in use, this one is not kept
+    }
+  this->evict(victim);
+  victim->text = (char*) aJsonMalloc(length + 1);
+  if (victim->text == NULL)
+    {
+      return item;
+    }
+  memcpy(victim->text, json, length + 1);
+  victim->length = length;
+  victim->hash = hash;
+  victim->item = item;
+  victim->users = 1;
+  victim->used = ++clock;
+  return item;
+}
+
+bool
+aJsonParseCache::release(aJsonObject *item)
 {
-  addItemToObject(object, name, createItem(n));
+  for (unsigned char i = 0; i < count; i++)
+    {
+      if (entries[i].item == item)
+        {
+          if (entries[i].users > 0)
+            entries[i].users--;
+          return true;
+        }
+    }
+  return false;
 }
 
+// Free the tree and text of an entry.
 void
-aJsonClass::addNumberToObject(aJsonObject* object, const char* name, double n)
+aJsonParseCache::evict(aJsonCacheEntry *entry)
 {
-  addItemToObject(object, name, createItem(n));
+  if (entry->item == NULL)
+    {
+      return;
+    }
+  aJsonObject *item = entry->item;
+  entry->item = NULL; // so that deleteItem() frees it
+  aJson.deleteItem(item);
+  aJsonFree(entry->text, entry->length + 1);
+  entry->text = NULL;
 }
 
 void
-aJsonClass::addStringToObject(aJsonObject* object, const char* name,
-    const char* s)
+aJsonParseCache::clear()
 {
-  addItemToObject(object, name, createItem(s));
+  for (unsigned char i = 0; i < count; i++)
+    {
+      if (entries[i].users == 0)
+        {
+          this->evict(&entries[i]);
+        }
+    }
 }
 
 //TODO conversion routines btw. float & int types?
@@ -29,6 +29,7 @@
 #include <Stream.h>
 #include <Client.h>
 #include <Arduino.h>  // To get access to the Arduino millis() function
+#include "utility/allocator.h"
 
 /******************************************************************************
  * Definitions
@@ -42,14 +43,73 @@
 #define aJson_Array 5
 #define aJson_Object 6
 
+// Never set any more, references became shared trees (see share()). Kept so old code still builds.
 #define aJson_IsReference 128
 
+// aJsonObject flags:
+#define aJson_Packed 1 // The array keeps its numbers in valuepacked instead of child.
+#define aJson_Lazy 2 // The object or array is still the text in valuetext, parsed on first access
+                     // with the stream options kept in the bits of flags from aJson_LazyShift on.
+#define aJson_Raw 4 // The number is still the text in valueraw, see aJsonClass::getInt().
+#define aJson_StaticName 8 // The name is borrowed and not freed with the item.
+#define aJson_Shared 16 // The children are shared with other items, valueshare counts them. See aJsonClass::share().
+#define aJson_LazyShift 5
+#define aJson_Frozen 32 // Read only, see aJsonClass::freeze(). Only without aJson_Lazy, whose stream
+                        // options use the same bits.
+
+// Options of aJsonStream::setOptions():
+#define aJson_PackNumbers 1 // Parse arrays of numbers into packed arrays.
+#define aJson_LazyParse 2 // Only record nested objects and arrays, parse them when accessed.
+                          // For aJsonStringStream only, its buffer has to outlive the tree.
+#define aJson_RawNumbers 4 // Keep numbers as text, converted when first asked for and printed unchanged.
+
 #ifndef EOF
 #define EOF -1
 #endif
 
 #define PRINT_BUFFER_LEN 256
 
+// How deep scanValue() can nest objects and arrays
+#define SCAN_MAX_DEPTH 64
+// How deep the writer methods of aJsonStream can nest, one bit of an unsigned long per level
+#define WRITER_MAX_DEPTH 32
+// How deep an aJsonSerializer can nest, each level costs a few bytes of the serializer
+#define SERIALIZER_MAX_DEPTH 16
+// How many versions an aJsonPublisher can hold while readers still use them
+#define PUBLISHER_VERSIONS 4
+
+// The numbers of a packed array, allocated in one piece with this header.
+typedef struct aJsonPacked {
+	unsigned char count; // The number of values.
+	unsigned char capacity; // The number of values there is room for.
+	char type; // aJson_Int or aJson_Float.
+	union {
+		int *ints; // The values if type==aJson_Int
+		double *floats; // The values if type==aJson_Float
+	};
+} aJsonPacked;
+
+// A number kept as it was written, allocated in one piece with its text.
+typedef struct aJsonRaw {
+	union {
+		int valueint; // The value if converted and the item's type==aJson_Int
+		double valuefloat; // The value if converted and the item's type==aJson_Float
+	};
+	char converted; // Whether the value has been worked out yet.
+	char *text; // The number, 0 terminated.
+} aJsonRaw;
+
+// A piece of the input that has not been parsed yet.
+typedef struct aJsonText {
+	const char *start;
+	unsigned int length;
+} aJsonText;
+
+// The items sharing the children of an object or array.
+typedef struct aJsonShare {
+	unsigned int users;
+} aJsonShare;
+
 // The aJson structure:
 typedef struct aJsonObject {
         char *name; // The item's name string, if this item is the child of, or is in the list of subitems of an object.
@@ -57,15 +117,81 @@ typedef struct aJsonObject {
 	struct aJsonObject *child; // An array or object item will have a child pointer pointing to a chain of the items in the array/object.
 
 	char type; // The type of the item, as above.
+	unsigned char flags; // How the value is stored, see aJson_Packed and aJson_Lazy.
 
 	union {
 		char *valuestring; // The item's string, if type==aJson_String
+		aJsonPacked *valuepacked; // The array's numbers, if flags has aJson_Packed
+		aJsonText valuetext; // The unparsed object or array, if flags has aJson_Lazy
+		aJsonRaw *valueraw; // The number as text, if flags has aJson_Raw
+		aJsonShare *valueshare; // Who else has the children, if flags has aJson_Shared
 		char valuebool; //the items value for true & false
 		int valueint; // The item's value, if type==aJson_Int
 		double valuefloat; // The item's value, if type==aJson_Float
 	};
 } aJsonObject;
 
+// One step of a compiled path: an object key and, if the key is a number, an array index.
+typedef struct aJsonPathSegment {
+	const char *key; // The unescaped key, 0 terminated.
+	unsigned char length; // strlen(key).
+	unsigned int hash; // Case insensitive hash of key, see aJsonClass::compilePath().
+	int index; // The array index denoted by key, -1 if key is not a number.
+} aJsonPathSegment;
+
+// A JSON Pointer (RFC 6901) or dotted path compiled by aJsonClass::compilePath().
+// Segments and keys live in the same allocation, free it with aJsonClass::deletePath().
+typedef struct aJsonPath {
+	unsigned char count; // The number of segments, 0 addresses the root itself.
+	unsigned char step; // Scratch for getPathItems() and project(), do not share a path between concurrent uses.
+	bool exact; // Keys match case sensitive - JSON Pointers do, dotted paths match like getObjectItem().
+	size_t size; // Of the allocation.
+	aJsonPathSegment *segments;
+} aJsonPath;
+
+struct aJsonProjection;
+
+// Why aJsonClass::validate() failed:
+#define aJson_ErrorNone 0 // it did not
+#define aJson_ErrorEnd 1 // the input ended in the middle of a value
+#define aJson_ErrorUnexpected 2 // a character that cannot appear there
+#define aJson_ErrorString 3 // a control character or bad escape in a string
+#define aJson_ErrorNumber 4 // a malformed number
+#define aJson_ErrorLiteral 5 // not quite true, false or null
+#define aJson_ErrorDepth 6 // nested deeper than SCAN_MAX_DEPTH
+
+// Where and why aJsonClass::validate() failed.
+typedef struct aJsonError {
+	unsigned long offset; // The number of characters before the offending one.
+	char reason; // One of the aJson_Error* codes.
+} aJsonError;
+
+// Maps a JSON key to a member of a struct for aJsonStream::parseStruct() and printStruct().
+// Declare them with the aJson_*_FIELD macros, which work everything out at compile time.
+typedef struct aJsonField {
+	const char *key;
+	unsigned char length; // strlen(key), compared before the key itself.
+	char type; // aJson_Boolean, aJson_Int, aJson_Float, aJson_String or aJson_Object.
+	size_t size; // sizeof the member - a char array for aJson_String.
+	size_t offset; // offsetof the member.
+	const struct aJsonField *fields; // The fields of the nested struct for aJson_Object.
+	unsigned char count; // The number of fields.
+} aJsonField;
+
+#define aJson_FIELD(type, member, key, json, fields, count) \
+	{ key, sizeof(key) - 1, json, sizeof(((type*) 0)->member), offsetof(type, member), fields, count }
+// A bool member.
+#define aJson_BOOL_FIELD(type, member, key) aJson_FIELD(type, member, key, aJson_Boolean, NULL, 0)
+// A signed char, short, int or long member.
+#define aJson_INT_FIELD(type, member, key) aJson_FIELD(type, member, key, aJson_Int, NULL, 0)
+// A float or double member.
+#define aJson_FLOAT_FIELD(type, member, key) aJson_FIELD(type, member, key, aJson_Float, NULL, 0)
+// A char array member, longer strings are cut to fit.
+#define aJson_STRING_FIELD(type, member, key) aJson_FIELD(type, member, key, aJson_String, NULL, 0)
+// A struct member, described by an array of fields of its own.
+#define aJson_OBJECT_FIELD(type, member, key, fields) \
+	aJson_FIELD(type, member, key, aJson_Object, fields, sizeof(fields) / sizeof(aJsonField))
+
 /* aJsonStream is stream representation of aJson for its internal use;
  * it is meant to abstract out differences between Stream (e.g. serial
  * stream) and Client (which may or may not be connected) or provide even
@@ -73,7 +199,9 @@ typedef struct aJsonObject {
 class aJsonStream : public Print {
 public:
 	aJsonStream(Stream *stream_)
-		: stream_obj(stream_), bucket(EOF)
+		: stream_obj(stream_), bucket(EOF), consumed(0), allocator(NULL),
+		  options(0), writer_objects(0), writer_items(0), writer_depth(0),
+		  writer_key(false)
 		{}
 	/* Use this to check if more data is available, as aJsonStream
 	 * can read some more data than really consumed and automatically
@@ -90,9 +218,17 @@ public:
 
 	int skip();
 	int flush();
+	/* Skip one complete value of any type without allocating anything. */
+	int skipValue();
+	/* Read a string value into buffer without allocating, truncated to
+	 * len - 1 characters. Returns the full length of the string or EOF. */
+	int readString(char *buffer, size_t len);
 
 	int parseValue(aJsonObject *item, char** filter);
 	int printValue(aJsonObject *item);
+	/* Same, with the members of objects sorted by name and raw
+	 * numbers converted, so equal trees print the same. */
+	int printCanonical(aJsonObject *item);
 
 	int parseArray(aJsonObject *item, char** filter);
 	int printArray(aJsonObject *item);
@@ -100,7 +236,85 @@ public:
 	int parseObject(aJsonObject *item, char** filter);
 	int printObject(aJsonObject *item);
 
+	int parseProjection(aJsonObject *item, aJsonProjection *projection,
+			unsigned char depth);
+	int parseMergePatch(aJsonObject *target);
+
+	/* Check one value and copy it to out (if not NULL) with normalized
+	 * whitespace - indented by indent spaces per level or compact if
+	 * indent is 0. Nothing is allocated, the nesting is tracked in a
+	 * fixed bit stack of SCAN_MAX_DEPTH levels. Stops right after the
+	 * value and leaves whatever follows in the stream. */
+	int scanValue(aJsonStream *out, unsigned char indent,
+			aJsonError *error = NULL);
+	/* Check one value like scanValue() without copying it, reading on
+	 * to the end of the stream: only whitespace may follow the value. */
+	int scanDocument(aJsonError *error = NULL);
+
+	/* Parse an object straight into the struct at target, without
+	 * allocating anything. Keys not in fields are skipped, members
+	 * whose key is missing or null are left alone, keys of 64
+	 * characters or more never match. Returns 0 or EOF, in which case
+	 * target may be filled in partially. */
+	int parseStruct(void *target, const aJsonField *fields, unsigned char count);
+	/* Print the struct at source as an object with all fields. */
+	int printStruct(const void *source, const aJsonField *fields, unsigned char count);
+
+	/* Write JSON right away, without building a tree or allocating
+	 * anything. Commas are put in for you, key() has to come before
+	 * every value inside an object. Nesting is limited to
+	 * WRITER_MAX_DEPTH. All return 0 or EOF. */
+	int beginObject();
+	int endObject();
+	int beginArray();
+	int endArray();
+	int key(const char *name);
+	int value(int number);
+	int value(long number);
+	int value(double number);
+	int value(const char *string);
+	int value(bool boolean);
+	int value(aJsonObject *item);
+	int nullValue();
+
+	/* The number of characters read so far, characters returned by
+	 * ungetch() do not count. */
+	unsigned long bytesRead() { return consumed; }
+
+	/* Allocate whatever is parsed from this stream with allocator
+	 * instead of the global one, NULL goes back to the global one.
+	 * Free the result with aJson.deleteItem(item, allocator). */
+	void setAllocator(const aJsonAllocator *allocator_) { allocator = allocator_; }
+	const aJsonAllocator *getAllocator() { return allocator; }
+
+	/* Change how values are parsed, a combination of aJson_PackNumbers
+	 * and the like. */
+	void setOptions(unsigned char options_) { options = options_; }
+	unsigned char getOptions() { return options; }
+
 protected:
+	friend class aJsonArrayReader;
+	int scanString(aJsonStream *out, aJsonError *error);
+	int scanNumber(aJsonStream *out, aJsonError *error);
+	int scanLiteral(aJsonStream *out, const char *literal, aJsonError *error);
+	int scanKey(aJsonStream *out, unsigned char indent, aJsonError *error);
+	int scanError(aJsonError *error, char reason, int in);
+	int parseField(void *member, const aJsonField *field);
+	int parsePacked(aJsonObject *item, int *in);
+	int unpackMixed(aJsonObject *item, aJsonObject *value, int *in);
+	int parseRawNumber(aJsonObject *item);
+	int parseMember(aJsonObject *item, char** filter);
+	int parseLazy(aJsonObject *item, int in);
+	int readEscape(char *out);
+	int readHex(unsigned int *code);
+	int writeComma();
+	int writeSeparator();
+	int writeClose(char bracket);
+
+	/* Where the next character is read from, if the input is in
+	 * memory - NULL otherwise. */
+	virtual const char *position() { return NULL; }
+
 	/* Blocking load of character, returning EOF if the stream
 	 * is exhausted. */
 	/* Base implementation just looks at bucket, returns EOF
@@ -114,6 +328,7 @@ protected:
 
 	/* Inherited from class Print. */
 	virtual size_t write(uint8_t ch);
+	using Print::write;
 
 	/* stream attribute is used only from virtual functions,
 	 * therefore an object inheriting aJsonStream may avoid
@@ -127,6 +342,19 @@ protected:
 	 * to be returned by next getch() - returned by a call
 	 * to ungetch(). */
 	int bucket;
+
+	/* Characters read, maintained by getch() and ungetch(). */
+	unsigned long consumed;
+
+	const aJsonAllocator *allocator;
+	unsigned char options;
+
+	/* State of the writer: a bit per level telling whether it is an
+	 * object and whether it has an item yet, and whether we are just
+	 * after a key. */
+	unsigned long writer_objects, writer_items;
+	unsigned char writer_depth;
+	bool writer_key;
 };
 
 /* JSON stream that consumes data from a connection (usually
@@ -152,19 +380,217 @@ public:
 	/* Either of inbuf, outbuf can be NULL if you do not care about
 	 * particular I/O direction. */
 	aJsonStringStream(char *inbuf_, char *outbuf_ = NULL, size_t outbuf_len_ = 0)
-		: aJsonStream(NULL), inbuf(inbuf_), outbuf(outbuf_), outbuf_len(outbuf_len_)
+		: aJsonStream(NULL), inbuf(inbuf_), outbuf(outbuf_), outbuf_len(outbuf_len_),
+		  dropped(0)
 	{
 		inbuf_len = inbuf ? strlen(inbuf) : 0;
 	}
+	/* Read inbuf_len characters of inbuf, which need not be 0 terminated. */
+	aJsonStringStream(char *inbuf_, char *outbuf_, size_t outbuf_len_, size_t inbuf_len_)
+		: aJsonStream(NULL), inbuf(inbuf_), outbuf(outbuf_), inbuf_len(inbuf_len_),
+		  outbuf_len(outbuf_len_), dropped(0)
+		{}
 
 	virtual bool available();
+	/* Characters that did not fit into outbuf. */
+	size_t truncated() { return dropped; }
 
 private:
 	virtual int getch();
 	virtual size_t write(uint8_t ch);
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	virtual const char *position();
 
 	char *inbuf, *outbuf;
 	size_t inbuf_len, outbuf_len;
+	size_t dropped;
+};
+
+/* Prints a tree a piece at a time. write() sends as much as the sink
+ * takes and returns how many characters went out; call it again later
+ * to carry on where it stopped, down to the character. The tree must not
+ * change until done(). Nothing is allocated. */
+class aJsonSerializer {
+public:
+	aJsonSerializer(aJsonObject *item = NULL) { reset(item); }
+
+	/* Start over with another tree. */
+	void reset(aJsonObject *item);
+	/* Write at most limit characters, stopping early when sink->write()
+	 * returns 0. */
+	size_t write(Print *sink, size_t limit = (size_t) -1);
+	/* Everything has been written, or it failed. */
+	bool done()
+	{
+		return phase == Failed
+			|| (phase == Done && text == NULL && chunk_pos == chunk_len);
+	}
+	/* The tree is nested deeper than SERIALIZER_MAX_DEPTH or a lazy
+	 * part of it does not parse. */
+	bool failed() { return phase == Failed; }
+	/* Characters written since reset(). */
+	size_t produced() { return total; }
+
+private:
+	enum Phase { Value, Colon, Member, Done, Failed };
+	struct Frame {
+		aJsonObject *item; // the array or object
+		aJsonObject *child; // the next member to write
+		unsigned char index; // members written, the next packed number
+	};
+
+	bool step();
+	void value(aJsonObject *item);
+	void close();
+
+	Frame stack[SERIALIZER_MAX_DEPTH];
+	unsigned char depth;
+	Phase phase;
+	aJsonObject *node; // written in the Value phase
+	const char *text; // the rest of a string being written
+	bool escape; // text is a string, not a raw number
+	char chunk[24]; // characters waiting to go out
+	unsigned char chunk_len, chunk_pos;
+	size_t total;
+};
+
+/* Collects a document as it arrives, without ever waiting for more.
+ * feed() takes what is there and stops after the end of the document,
+ * the rest belongs to the next one. Once ready(), take() parses it and
+ * starts over. The document has to fit into buffer. Numbers, true, false
+ * and null on their own only end with the character after them. */
+class aJsonParser {
+public:
+	aJsonParser(char *buffer_, size_t size_)
+		: buffer(buffer_), size(size_)
+		{ reset(); }
+
+	/* Forget what has been collected. */
+	void reset();
+	/* Take up to len characters, return how many were used. */
+	size_t feed(const char *data, size_t len);
+	/* Take what stream has available right now. */
+	size_t feed(Stream *stream);
+	/* A whole document is there. */
+	bool ready() { return state == Ready; }
+	/* The document does not fit into the buffer or is nested deeper
+	 * than 255 levels. Call reset() to go on. */
+	bool failed() { return state == Failed; }
+	/* Parse the document and start over. Returns NULL if it was not
+	 * ready or does not parse. */
+	aJsonObject *take();
+
+private:
+	enum State { Start, Nested, String, Scalar, Ready, Failed };
+
+	int add(char ch);
+
+	char *buffer;
+	size_t size, length;
+	State state;
+	unsigned char depth;
+	bool in_string, escaped;
+};
+
+/* Reads an array from a stream one element at a time, so only the
+ * current element has to fit into memory. next() deletes the element it
+ * returned before and parses the next one, keep a duplicate() of it if
+ * you need it longer. Elements come from the allocator of the stream. */
+class aJsonArrayReader {
+public:
+	aJsonArrayReader(aJsonStream *stream_)
+		: stream(stream_), item(NULL), state(Start), count(0)
+		{}
+	~aJsonArrayReader();
+
+	/* The next element, NULL at the end of the array or if the
+	 * input is not an array or broken, see failed(). */
+	aJsonObject *next();
+	/* The input was not an array, or broken. */
+	bool failed() { return state == Failed; }
+	/* How many elements next() has returned. */
+	unsigned long read() { return count; }
+
+private:
+	enum State { Start, Items, Done, Failed };
+
+	void release();
+
+	aJsonStream *stream;
+	aJsonObject *item; // returned last time, deleted by the next call
+	State state;
+	unsigned long count;
+};
+
+// A tree kept by an aJsonParseCache.
+typedef struct aJsonCacheEntry {
+	char *text; // A copy of the input it was parsed from.
+	size_t length;
+	uint64_t hash;
+	aJsonObject *item; // NULL if the entry is free.
+	unsigned char users; // Parses that returned it and were not deleted yet.
+	unsigned long used; // When it was returned last.
+} aJsonCacheEntry;
+
+/* Remembers the trees of the last few strings parsed by
+ * aJsonClass::parse(char*) once installed with aJson.setParseCache().
+ * Parsing the same text again then only costs hashing and comparing it,
+ * and returns the same tree. The trees are shared, so they are frozen
+ * and changing them or adding them to another tree fails. Deleting them
+ * is fine, they are only freed when they are the least recently used ones
+ * and another text needs the room. The cache has to stay installed until
+ * every tree it returned is deleted. */
+class aJsonParseCache {
+public:
+	/* Keep up to count trees in entries. */
+	aJsonParseCache(aJsonCacheEntry *entries_, unsigned char count_);
+
+	/* The tree for json, parsed or from the cache. */
+	aJsonObject *parse(char *json);
+	/* Free the trees nobody uses right now. */
+	void clear();
+	/* How many parses were answered from the cache and how many not. */
+	unsigned long getHits() { return hits; }
+	unsigned long getMisses() { return misses; }
+
+private:
+	friend class aJsonClass;
+	/* Called by deleteItem(), true if item belongs to the cache. */
+	bool release(aJsonObject *item);
+	void evict(aJsonCacheEntry *entry);
+
+	aJsonCacheEntry *entries;
+	unsigned char count;
+	unsigned long clock, hits, misses;
+};
+
+/* Hands the current version of a document to readers while it is
+ * replaced, without ever making anybody wait. Readers acquire() the
+ * current version and release() it when done. publish() freezes a new
+ * document and makes it current, old versions are deleted once their
+ * last reader released them. Readers may run in interrupts or other
+ * threads, publish() and reclaim() must only be called from one place. */
+class aJsonPublisher {
+public:
+	aJsonPublisher();
+
+	/* The current version, NULL if none was published yet. Read
+	 * only, release() it when done. */
+	aJsonObject *acquire();
+	void release(aJsonObject *document);
+	/* Freeze document and make it the current version, it belongs to
+	 * the publisher from now on. Returns EOF if it cannot be frozen or
+	 * PUBLISHER_VERSIONS old versions are still being read; the
+	 * document is then still yours. */
+	int publish(aJsonObject *document);
+	/* Delete the old versions nobody reads any more. Returns how many
+	 * old versions are left. */
+	unsigned char reclaim();
+
+private:
+	aJsonObject *volatile versions[PUBLISHER_VERSIONS];
+	volatile unsigned int readers[PUBLISHER_VERSIONS];
+	volatile unsigned char current;
 };
 
 class aJsonClass {
@@ -180,21 +606,93 @@ public:
         aJsonObject* parse(aJsonStream* stream); //Reads from a stream
         aJsonObject* parse(aJsonStream* stream,char** filter_values); //Read from a file, but only return values include in the char* array filter_values
 	aJsonObject* parse(char *value); //Reads from a string
+	aJsonObject* parse(char *value, unsigned char options); //Same, with aJson_LazyParse and the like
 	// Render a aJsonObject entity to text for transfer/storage. Free the char* when finished.
 	int print(aJsonObject *item, aJsonStream* stream);
 	char* print(aJsonObject* item);
 	//Renders a aJsonObject directly to a output stream
 	char stream(aJsonObject *item, aJsonStream* stream);
+	// How many characters print() makes of item, worked out without a buffer. Use it to
+	// allocate exactly what is needed, or to give subtrees their own place in one buffer.
+	size_t printedLength(aJsonObject *item);
+	// Render item into buffer, 0 terminated. Returns how many characters item takes like
+	// snprintf() does: if that is size or more, buffer only holds the first size-1 of them.
+	size_t print(aJsonObject *item, char *buffer, size_t size);
+	// Copy one JSON value from in to out without building a tree, validating it on the way.
+	// Whitespace is normalized: compact with indent 0, else indent spaces per level.
+	// Returns 0 or EOF if the input is malformed - out then ends somewhere in the middle.
+	// Reading stops right after the value, whatever follows is left in the stream.
+	int transcode(aJsonStream* in, aJsonStream* out, unsigned char indent = 0,
+			aJsonError *error = NULL);
+	// Check that the stream holds a valid JSON value without allocating anything.
+	// The stream is read up to its end and only whitespace may follow the value.
+	// Returns 0 or EOF, in which case error (if not NULL) tells where and why.
+	// Offsets are counted from where the stream was when validate() was called.
+	int validate(aJsonStream* stream, aJsonError *error = NULL);
+	// Parse only what the paths point to, skipping everything else without allocating. Returns a
+	// tree holding just the matched values and the containers leading to them (arrays keep only the
+	// matched elements). values[i] gets the item for paths[i] or NULL if values is not NULL. With
+	// stop set reading ends as soon as every path is resolved, the rest of the input is left unread.
+	// Keys of 64 characters or more are never matched.
+	aJsonObject* project(aJsonStream* stream, aJsonPath **paths, unsigned char count,
+			aJsonObject **values = NULL, bool stop = false);
+	// Find where the elements of the array in json (length characters) begin and end by
+	// looking only at brackets, commas and quotes, without parsing or allocating anything.
+	// The first count ranges go to elements. Returns how many elements the array has, or
+	// EOF if json is not an array or ends early. The elements are checked when parsed.
+	int splitArray(const char *json, size_t length, aJsonText *elements,
+			unsigned char count);
+	// Parse count elements found by splitArray() into a new array, with allocator if it is not
+	// NULL. Returns NULL if one of them does not parse or memory ran out.
+	aJsonObject* parseElements(const aJsonText *elements, unsigned char count,
+			const aJsonAllocator *allocator = NULL);
+	// Move the items of part to the end of array, leaving part empty. Both have to be arrays,
+	// or both objects. Returns 0 or EOF.
+	int appendArray(aJsonObject *array, aJsonObject *part);
 	// Delete a aJsonObject entity and all sub-entities.
 	void deleteItem(aJsonObject *c);
+	// Same for items that were allocated by allocator, e.g. parsed from a stream with its own allocator.
+	void deleteItem(aJsonObject *c, const aJsonAllocator *allocator);
+
+	// The value of a number, whatever type it is and whether it is still raw text (see
+	// aJson_RawNumbers). Always use these for numbers parsed with aJson_RawNumbers.
+	int getInt(aJsonObject *item);
+	double getFloat(aJsonObject *item);
 
 	// Returns the number of items in an array (or object).
 	unsigned char getArraySize(aJsonObject *array);
+	// The numbers of a packed array of ints or doubles, NULL if array is not packed that way.
+	// count gets the number of values. Packed arrays are made by create*Array(), pack() and
+	// the parser with aJson_PackNumbers set, for arrays of only ints or only floats. Accessing their items turns them into plain arrays.
+	int* getIntArray(aJsonObject *array, unsigned char *count);
+	double* getFloatArray(aJsonObject *array, unsigned char *count);
+	// Store an array of ints or of floats in one piece. Returns EOF if array is empty, mixes
+	// ints and floats or holds anything else.
+	int pack(aJsonObject *array);
+	// Turn a packed array back into a list of items - do this before walking its child yourself.
+	static int unpack(aJsonObject *array);
+	// Parse an object or array that was skipped by aJson_LazyParse, its children are still
+	// skipped the same way. Done for you by everything that looks at the items, returns 0 or EOF.
+	static int materialize(aJsonObject *item);
 	// Retrieve item number "item" from array "array". Returns NULL if unsuccessful.
 	aJsonObject* getArrayItem(aJsonObject *array, unsigned char item);
 	// Get item "string" from object. Case insensitive.
 	aJsonObject* getObjectItem(aJsonObject *object, const char *string);
 
+	// Compile a path once for repeated lookups. Paths starting with '/' are JSON Pointers
+	// ("/query/results/0/title"), anything else is dotted ("query.results[0].title").
+	// Keys of JSON Pointers match minding case as RFC 6901 says, dotted keys match case
+	// insensitive like getObjectItem. Returns NULL if the path is malformed.
+	aJsonPath* compilePath(const char *path);
+	void deletePath(aJsonPath *path);
+	// Resolve a path against root. Returns NULL if it does not exist.
+	aJsonObject* getPathItem(aJsonObject *root, aJsonPath *path);
+	aJsonObject* getPathItem(aJsonObject *root, const char *path);
+	// Resolve count paths in a single traversal, every container is scanned at most once.
+	// results[i] gets the item for paths[i] or NULL. Returns the number of paths found.
+	unsigned char getPathItems(aJsonObject *root, aJsonPath **paths,
+			unsigned char count, aJsonObject **results);
+
 	// These calls create a aJsonObject item of the appropriate type.
 	aJsonObject* createNull();
 	aJsonObject* createItem(bool b);
@@ -202,22 +700,58 @@ public:
 	aJsonObject* createItem(int num);
 	aJsonObject* createItem(double num);
 	aJsonObject* createItem(const char *string);
+	// A string item taking over string, which has to come from aJsonStrdup() or aJsonMalloc().
+	aJsonObject* createStringOwned(char *string);
 	aJsonObject* createArray();
 	aJsonObject* createObject();
 
-	// These utilities create an Array of count items.
+	// These utilities create an Array of count items, numbers are packed.
 	aJsonObject* createIntArray(int *numbers, unsigned char count);
 	aJsonObject* createFloatArray(double *numbers, unsigned char count);
 	aJsonObject* createDoubleArray(double *numbers, unsigned char count);
 	aJsonObject* createStringArray(const char **strings, unsigned char count);
 
-	// Append item to the specified array/object.
-	void addItemToArray(aJsonObject *array, aJsonObject *item);
-	void addItemToObject(aJsonObject *object, const char *string,
+	// Duplicate an item, with recurse set including all its children. The copy is
+	// not attached to anything and has to be deleted separately.
+	aJsonObject* duplicate(aJsonObject *item, bool recurse = true);
+	// A copy of an object or array like duplicate(), but sharing all children with item.
+	// Both have to be deleted, whichever goes last frees the children. When either is changed
+	// through aJson, it gets its own copy of that level first, with the objects and arrays below
+	// shared the same way. Other items are simply duplicated. Looking items up copies nothing,
+	// so what is found below a shared item is still shared: unshare() every container on the way
+	// down before changing it through what you found, or use a patch.
+	aJsonObject* share(aJsonObject *item);
+	// Give item its own copy of its children if they are shared. Returns 0 or EOF if memory ran out.
+	static int unshare(aJsonObject *item);
+	// Make item and its children read only, so they can be read from several threads or
+	// interrupts at once: everything is parsed, unpacked, unshared and converted now, so that
+	// reading never changes anything. Changing a frozen item fails, delete it as usual.
+	// Returns 0 or EOF if memory ran out, the tree is then partly frozen.
+	int freeze(aJsonObject *item);
+	bool isFrozen(aJsonObject *item);
+
+	// Append item to the specified array/object. These calls, down to replaceItemInObject(),
+	// return 0, or EOF if item could not be added, e.g. because the container is frozen or
+	// memory ran out. Item then still belongs to you, delete it if you do not need it.
+	// Frozen items are refused too: they belong to a cache or an aJsonPublisher.
+	int addItemToArray(aJsonObject *array, aJsonObject *item);
+	int addItemToObject(aJsonObject *object, const char *string,
+			aJsonObject *item);
+	// Same, but without copying the name: string has to stay valid as long as item does,
+	// like a string literal.
+	int addItemToObjectStatic(aJsonObject *object, const char *string,
+			aJsonObject *item);
+	// Same, but item takes over string, which has to come from aJsonStrdup() or aJsonMalloc().
+	int addItemToObjectOwned(aJsonObject *object, char *string,
+			aJsonObject *item);
+	// Give the member string of object the value of item and delete item. The member
+	// keeps its node and name, only if it is missing item is added under a copy of string.
+	int setItemInObject(aJsonObject *object, const char *string,
 			aJsonObject *item);
 	// Append reference to item to the specified array/object. Use this when you want to add an existing aJsonObject to a new aJsonObject, but don't want to corrupt your existing aJsonObject.
-	void addItemReferenceToArray(aJsonObject *array, aJsonObject *item);
-	void addItemReferenceToObject(aJsonObject *object, const char *string,
+	// The reference is made by share(), so item still has to be deleted on its own.
+	int addItemReferenceToArray(aJsonObject *array, aJsonObject *item);
+	int addItemReferenceToObject(aJsonObject *object, const char *string,
 			aJsonObject *item);
 
 	// Remove/Detach items from Arrays/Objects.
@@ -226,10 +760,12 @@ public:
 	aJsonObject* detachItemFromObject(aJsonObject *object, const char *string);
 	void deleteItemFromObject(aJsonObject *object, const char *string);
 
-	// Update array items.
-	void replaceItemInArray(aJsonObject *array, unsigned char which,
+	// Update array items. Replacing fails if there is no such item.
+	int insertItemInArray(aJsonObject *array, unsigned char which,
+			aJsonObject *newitem); // Shifts pre-existing items to the right.
+	int replaceItemInArray(aJsonObject *array, unsigned char which,
 			aJsonObject *newitem);
-	void replaceItemInObject(aJsonObject *object, const char *string,
+	int replaceItemInObject(aJsonObject *object, const char *string,
 			aJsonObject *newitem);
 
 	void addNullToObject(aJsonObject* object, const char* name);
@@ -239,16 +775,213 @@ public:
 	void addStringToObject(aJsonObject* object, const char* name,
 					const char* s);
 
+	// Compare two trees and return the JSON Patch (RFC 6902) turning from into to - an
+	// array of add, remove and replace operations on just the parts that changed. Names
+	// are compared minding case, elements inserted into or removed from an array are
+	// found as long as the elements around them did not change.
+	aJsonObject* diff(aJsonObject *from, aJsonObject *to);
+	// Apply a JSON Patch to root in place. The values are moved out of the patch into
+	// root, delete the patch afterwards. Returns 0 or EOF when an operation fails, in
+	// which case the operations before it remain applied.
+	int applyPatch(aJsonObject *root, aJsonObject *patch);
+	// Apply a JSON Merge Patch (RFC 7386) to target in place. Existing items are updated
+	// rather than replaced, values are moved out of patch. Names match minding case, unlike
+	// getObjectItem(). Returns 0 or EOF.
+	int mergePatch(aJsonObject *target, aJsonObject *patch);
+	// Same, but read the patch from a stream. Only the new values are ever allocated,
+	// the patch itself is never built. On EOF target may be patched partially.
+	int mergePatch(aJsonObject *target, aJsonStream *stream);
+
+	// Whether a and b hold the same JSON. Members of objects may come in any order, names match
+	// case insensitive like getObjectItem. A name used twice pairs up the members in order.
+	// Ints never equal floats, raw numbers equal by value.
+	bool equals(aJsonObject *a, aJsonObject *b);
+	// A 64 bit hash of the content of item, the same for items equals() finds equal. Computed on
+	// the tree itself, nothing is printed or allocated.
+	uint64_t hash(aJsonObject *item);
+	// Print item with the members of every object sorted by name (byte by byte) and all numbers in
+	// one format, so the same JSON always prints the same. Returns 0 or EOF.
+	int printCanonical(aJsonObject *item, aJsonStream* stream);
+
+	// Fill in a struct from the stream, see aJsonStream::parseStruct(). Returns 0 or EOF.
+	int parseStruct(aJsonStream *stream, void *target, const aJsonField *fields,
+			unsigned char count);
+	// Print a struct to the stream as a JSON object.
+	int printStruct(aJsonStream *stream, const void *source, const aJsonField *fields,
+			unsigned char count);
+	// The same, counting the fields for you.
+	template<size_t N> int parseStruct(aJsonStream *stream, void *target,
+			const aJsonField (&fields)[N])
+	{
+		return parseStruct(stream, target, fields, N);
+	}
+	template<size_t N> int printStruct(aJsonStream *stream, const void *source,
+			const aJsonField (&fields)[N])
+	{
+		return printStruct(stream, source, fields, N);
+	}
+
+	// Allocate all nodes, names and strings from allocator, NULL goes back to malloc() and free().
+	// Items have to be freed by the allocator they came from, so switch before creating any.
+	void setAllocator(const aJsonAllocator *allocator);
+	// Take the nodes from pool before asking the allocator, NULL to stop. Delete all nodes from
+	// the pool before you stop, see aJsonNodePoolInit() in utility/allocator.h.
+	void setNodePool(aJsonNodePool *pool);
+	// Answer parse(char*) from cache if possible, NULL to stop. Trees from the cache are shared
+	// and frozen, duplicate() them to change them. Delete every tree you got from the cache
+	// before you stop, deleteItem() would free it behind the cache's back afterwards. Uninstall
+	// the cache before it goes away.
+	void setParseCache(aJsonParseCache *cache);
+
+	// What aJson has allocated in total. Only counted if aJson_MEMORY_STATS is
+	// defined in utility/allocator.h, otherwise all zero.
+	void getMemoryStats(aJsonMemoryStats *stats);
+	// Start counting allocations and waste anew, the peak drops to what is in use now.
+	void resetMemoryStats();
+	// What a single item and its children occupy - works without aJson_MEMORY_STATS.
+	void measure(aJsonObject *item, aJsonMemoryStats *stats);
+
 protected:
 	friend class aJsonStream;
 	static aJsonObject* newItem();
+	void deleteValue(aJsonObject *c);
+	void deleteList(aJsonObject *c);
+	static int expand(aJsonObject *item, bool write = true);
+	static aJsonObject* walkPath(aJsonObject *item, aJsonPath *path,
+			unsigned char first, unsigned char last, bool write = false);
 
 private:
 	void suffixObject(aJsonObject *prev, aJsonObject *item);
-
-	aJsonObject* createReference(aJsonObject *item);
+	int diffItems(aJsonObject *from, aJsonObject *to, char *path,
+			size_t length, aJsonObject *patch);
+	int diffMembers(aJsonObject *from, aJsonObject *to, char *path,
+			size_t length, aJsonObject *patch);
+	int diffElements(aJsonObject *from, aJsonObject *to, char *path,
+			size_t length, aJsonObject *patch);
+	int addPatchOperation(aJsonObject *patch, const char *op,
+			const char *path, aJsonObject *value);
+	int applyOperation(aJsonObject *root, aJsonObject *operation);
+	void measureItem(aJsonObject *item, aJsonMemoryStats *stats);
+	int addPathItem(aJsonObject *root, aJsonPath *path, aJsonObject *value);
+	aJsonObject* detachPathItem(aJsonObject *root, aJsonPath *path);
 };
 
 extern aJsonClass aJson;
 
+#if __cplusplus >= 201103L
+/* Owns the string returned by aJsonClass::print() and frees it when it
+ * goes out of scope. Can be moved, but not copied. */
+class aJsonString {
+public:
+	explicit aJsonString(char *string_ = NULL) : string(string_) {}
+	aJsonString(aJsonString &&other) : string(other.release()) {}
+	aJsonString &operator=(aJsonString &&other)
+	{
+		if (this != &other) {
+			free(string);
+			string = other.release();
+		}
+		return *this;
+	}
+	aJsonString(const aJsonString &) = delete;
+	aJsonString &operator=(const aJsonString &) = delete;
+	~aJsonString() { free(string); }
+
+	const char *c_str() const { return string; }
+	explicit operator bool() const { return string != NULL; }
+	char *release() { char *result = string; string = NULL; return result; }
+
+private:
+	char *string;
+};
+
+/* Owns an aJsonObject and all its children and deletes them when it goes
+ * out of scope. Can be moved, but not copied - values are moved into
+ * objects and arrays without duplicating anything. */
+class aJsonValue {
+public:
+	explicit aJsonValue(aJsonObject *item_ = NULL, const aJsonAllocator *allocator_ = NULL)
+		: item(item_), allocator(allocator_) {}
+	aJsonValue(aJsonValue &&other)
+		: item(other.item), allocator(other.allocator) { other.item = NULL; }
+	aJsonValue &operator=(aJsonValue &&other)
+	{
+		if (this != &other) {
+			reset();
+			item = other.item;
+			allocator = other.allocator;
+			other.item = NULL;
+		}
+		return *this;
+	}
+	aJsonValue(const aJsonValue &) = delete;
+	aJsonValue &operator=(const aJsonValue &) = delete;
+	~aJsonValue() { reset(); }
+
+	aJsonObject *get() const { return item; }
+	aJsonObject *operator->() const { return item; }
+	explicit operator bool() const { return item != NULL; }
+	// Give up ownership, the caller has to delete the item.
+	aJsonObject *release() { aJsonObject *result = item; item = NULL; return result; }
+	void reset(aJsonObject *item_ = NULL)
+	{
+		if (item)
+			aJson.deleteItem(item, allocator);
+		item = item_;
+	}
+
+	// Look up members and elements, the item stays owned by this value.
+	aJsonObject *operator[](const char *name) const { return aJson.getObjectItem(item, name); }
+	aJsonObject *operator[](unsigned char index) const { return aJson.getArrayItem(item, index); }
+
+	// Move value into this object or array. add() copies name, addStatic() borrows it
+	// (it has to stay valid, like a string literal) and set() replaces an existing member.
+	aJsonValue &add(const char *name, aJsonValue &&value)
+	{
+		if (aJson.addItemToObject(item, name, value.get()) == 0)
+			value.release();
+		return *this;
+	}
+	aJsonValue &addStatic(const char *name, aJsonValue &&value)
+	{
+		if (aJson.addItemToObjectStatic(item, name, value.get()) == 0)
+			value.release();
+		return *this;
+	}
+	aJsonValue &set(const char *name, aJsonValue &&value)
+	{
+		if (aJson.setItemInObject(item, name, value.get()) == 0)
+			value.release();
+		return *this;
+	}
+	aJsonValue &add(aJsonValue &&value)
+	{
+		if (aJson.addItemToArray(item, value.get()) == 0)
+			value.release();
+		return *this;
+	}
+
+	aJsonString print() const { return aJsonString(aJson.print(item)); }
+	int print(aJsonStream *stream) const { return aJson.print(item, stream); }
+
+protected:
+	aJsonObject *item;
+	const aJsonAllocator *allocator;
+};
+
+/* The root of a parsed document, deleted with the allocator of the stream
+ * it was parsed from. */
+class aJsonDocument : public aJsonValue {
+public:
+	explicit aJsonDocument(aJsonObject *root = NULL, const aJsonAllocator *allocator_ = NULL)
+		: aJsonValue(root, allocator_) {}
+
+	static aJsonDocument parse(aJsonStream *stream)
+	{
+		return aJsonDocument(aJson.parse(stream), stream ? stream->getAllocator() : NULL);
+	}
+	static aJsonDocument parse(char *value) { return aJsonDocument(aJson.parse(value)); }
+};
+#endif
+
 #endif
@@ -0,0 +1,280 @@
+/*
+ * aJson
+ * allocator.c
+ *
+ *  http://interactive-matter.org/
+ *
+ *  This file is part of aJson.
+ *
+ *  aJson is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  aJson is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  You should have received a copy of the GNU General Public License
+ *  along with aJson.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+
+#ifdef aJson_MEMORY_STATS
+static aJsonMemoryStats memory_stats;
+
+static void
+countAllocation(size_t size, unsigned char node)
+{
+  memory_stats.bytes += size;
+  memory_stats.nodes += node;
+  memory_stats.allocations++;
+  if (memory_stats.bytes > memory_stats.peak)
+    {
+      memory_stats.peak = memory_stats.bytes;
+    }
+}
+
+static void
+countFree(size_t size, unsigned char node)
+{
+  //memory we did not allocate ourselves could make us go below zero
+  memory_stats.bytes -= (size < memory_stats.bytes) ? size : memory_stats.bytes;
+  memory_stats.nodes -= (node < memory_stats.nodes) ? node : memory_stats.nodes;
+}
+#else
+#define countAllocation(size, node)
+#define countFree(size, node)
+#endif
+
+static void*
+defaultAlloc(void* context, size_t size)
+{
+  (void) context;
+  return malloc(size);
+}
+
+static void
+defaultRelease(void* context, void* ptr, size_t size)
+{
+  (void) context;
+  (void) size;
+  free(ptr);
+}
+
+static const aJsonAllocator default_allocator =
+  { defaultAlloc, defaultRelease, NULL };
+static const aJsonAllocator* current_allocator = &default_allocator;
+
+const aJsonAllocator*
+aJsonUseAllocator(const aJsonAllocator* allocator)
+{
+  const aJsonAllocator* previous = current_allocator;
+  current_allocator = allocator ? allocator : &default_allocator;
+  return previous;
+}
+
+static void*
+allocate(size_t size)
+{
+  return current_allocator->alloc(current_allocator->context, size);
+}
+
+static void
+release(void* ptr, size_t size)
+{
+  current_allocator->release(current_allocator->context, ptr, size);
+}
+
+void*
+aJsonMalloc(size_t size)
+{
+  void* result = allocate(size);
+  if (result != NULL)
+    {
+      countAllocation(size, 0);
+    }
+  return result;
+}
+
+void
+aJsonFree(void* ptr, size_t size)
+{
+  if (ptr == NULL)
+    {
+      return;
+    }
+  countFree(size, 0);
+  release(ptr, size);
+}
+
+static aJsonNodePool* current_pool = NULL;
+
+int
+aJsonNodePoolInit(aJsonNodePool* pool, void* blocks, size_t block_size,
+    unsigned int capacity, unsigned char fallback)
+{
+  unsigned int i;
+  //every block has to hold the pointer of the free list, and keep it aligned
+  if (block_size < sizeof(void*))
+    {
+      block_size = sizeof(void*);
+    }
+  block_size = (block_size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+  memset(pool, 0, sizeof(aJsonNodePool));
+  if (blocks == NULL && capacity > 0)
+    {
+      blocks = allocate(block_size * capacity);
+      if (blocks == NULL)
+        {
+          return -1;
+        }
+      pool->owner = current_allocator;
+    }
+  pool->blocks = (char*) blocks;
+  pool->block_size = block_size;
+  pool->capacity = capacity;
+  pool->fallback = fallback;
+  for (i = capacity; i > 0; i--)
+    {
+      void** block = (void**) (pool->blocks + (i - 1) * block_size);
+      *block = pool->free_list;
+      pool->free_list = block;
+    }
+  return 0;
+}
+
+void
+aJsonNodePoolRelease(aJsonNodePool* pool)
+{
+  if (pool->owner != NULL)
+    {
+      pool->owner->release(pool->owner->context, pool->blocks,
+          pool->block_size * pool->capacity);
+    }
+  memset(pool, 0, sizeof(aJsonNodePool));
+}
+
+aJsonNodePool*
+aJsonUseNodePool(aJsonNodePool* pool)
+{
+  aJsonNodePool* previous = current_pool;
+  current_pool = pool;
+  return previous;
+}
+
+//whether node is one of the blocks of pool
+static unsigned char
+inPool(aJsonNodePool* pool, void* node)
+{
+  return pool != NULL && (char*) node >= pool->blocks
+      && (char*) node < pool->blocks + pool->block_size * pool->capacity;
+}
+
+void*
+aJsonMallocNode(size_t size)
+{
+  void* result;
+  aJsonNodePool* pool = current_pool;
+  if (pool != NULL && size <= pool->block_size && pool->free_list != NULL)
+    {
+      result = pool->free_list;
+      pool->free_list = *(void**) result;
+      pool->used++;
+      if (pool->used > pool->peak)
+        {
+          pool->peak = pool->used;
+        }
+    }
+  else
+    {
+      if (pool != NULL)
+        {
+          pool->misses++;
+          if (!pool->fallback)
+            {
+              return NULL;
+            }
+        }
+      result = allocate(size);
+    }
+  if (result != NULL)
+    {
+      countAllocation(size, 1);
+    }
+  return result;
+}
+
+void
+aJsonFreeNode(void* node, size_t size)
+{
+  if (node == NULL)
+    {
+      return;
+    }
+  countFree(size, 1);
+  if (inPool(current_pool, node))
+    {
+      *(void**) node = current_pool->free_list;
+      current_pool->free_list = node;
+      current_pool->used--;
+      return;
+    }
+  release(node, size);
+}
+
+char*
+aJsonStrdup(const char* string)
+{
+  size_t size = strlen(string) + 1;
+  char* result = aJsonMalloc(size);
+  if (result != NULL)
+    {
+      memcpy(result, string, size);
+    }
+  return result;
+}
+
+void
+aJsonFreeString(char* string)
+{
+  if (string != NULL)
+    {
+      aJsonFree(string, strlen(string) + 1);
+    }
+}
+
+void
+aJsonCountPrintBuffer(size_t unused, size_t dropped)
+{
+#ifdef aJson_MEMORY_STATS
+  memory_stats.wasted += unused;
+  memory_stats.truncated += dropped;
+#else
+  (void) unused;
+  (void) dropped;
+#endif
+}
+
+void
+aJsonGetMemoryStats(aJsonMemoryStats* stats)
+{
+#ifdef aJson_MEMORY_STATS
+  *stats = memory_stats;
+#else
+  memset(stats, 0, sizeof(aJsonMemoryStats));
+#endif
+}
+
+void
+aJsonResetMemoryStats(void)
+{
+#ifdef aJson_MEMORY_STATS
+  memory_stats.peak = memory_stats.bytes;
+  memory_stats.allocations = 0;
+  memory_stats.wasted = 0;
+  memory_stats.truncated = 0;
+#endif
+}
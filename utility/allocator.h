@@ -0,0 +1,125 @@
+/*
+ * aJson
+ * allocator.h
+ *
+ *  http://interactive-matter.org/
+ *
+ *  This file is part of aJson.
+ *
+ *  aJson is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  aJson is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  You should have received a copy of the GNU General Public License
+ *  along with aJson.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALLOCATOR_H_
+#define ALLOCATOR_H_
+
+#include <stddef.h>
+
+//uncomment to let aJson count its memory use - see aJsonClass::getMemoryStats()
+//#define aJson_MEMORY_STATS
+
+//what aJson has allocated
+typedef struct
+{
+  unsigned long bytes; //bytes in use
+  unsigned long nodes; //aJsonObjects in use
+  unsigned long peak; //the most bytes ever in use at the same time
+  unsigned long allocations; //how often memory was allocated
+  unsigned long wasted; //bytes of print buffers left unused
+  unsigned long truncated; //bytes dropped since a print buffer was full
+} aJsonMemoryStats;
+
+//where aJson gets its memory from - release() is handed the size that was
+//allocated, so pools and slabs do not have to store it
+typedef struct
+{
+  void* (*alloc)(void* context, size_t size);
+  void (*release)(void* context, void* ptr, size_t size);
+  void* context;
+} aJsonAllocator;
+
+//a fixed number of equally sized blocks for the nodes of aJson, free blocks
+//are kept in a list running through the blocks themselves - see aJsonUseNodePool()
+typedef struct
+{
+  char* blocks; //capacity blocks of block_size bytes each
+  size_t block_size;
+  unsigned int capacity;
+  void* free_list; //the first free block, which points to the next one
+  const aJsonAllocator* owner; //allocated the blocks, NULL if they were handed in
+  unsigned char fallback; //whether to use the allocator once all blocks are taken
+  unsigned int used; //blocks handed out right now
+  unsigned int peak; //the most blocks ever handed out at the same time
+  unsigned long misses; //nodes the pool had no block for
+} aJsonNodePool;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  //make allocator the one used from now on, NULL goes back to malloc and free
+  //returns the allocator used until now
+  const aJsonAllocator*
+  aJsonUseAllocator(const aJsonAllocator* allocator);
+
+  //set up pool with capacity blocks of block_size bytes - at blocks, e.g. a
+  //static array, or taken from the current allocator once if blocks is NULL
+  //with fallback nodes are allocated as usual once the pool is empty, otherwise
+  //creating them fails. returns 0 or -1 if the blocks could not be allocated
+  int
+  aJsonNodePoolInit(aJsonNodePool* pool, void* blocks, size_t block_size,
+      unsigned int capacity, unsigned char fallback);
+
+  //give back blocks allocated by aJsonNodePoolInit(), the pool must not be in use
+  void
+  aJsonNodePoolRelease(aJsonNodePool* pool);
+
+  //take the nodes from pool from now on, NULL to stop - delete all nodes from
+  //the pool before uninstalling it. returns the pool used until now
+  aJsonNodePool*
+  aJsonUseNodePool(aJsonNodePool* pool);
+
+  //all memory of aJson is allocated and freed through these
+
+  void*
+  aJsonMalloc(size_t size);
+
+  void
+  aJsonFree(void* ptr, size_t size);
+
+  void*
+  aJsonMallocNode(size_t size);
+
+  void
+  aJsonFreeNode(void* node, size_t size);
+
+  char*
+  aJsonStrdup(const char* string);
+
+  void
+  aJsonFreeString(char* string);
+
+  //book keeping of print buffers, which are freed by the user
+  void
+  aJsonCountPrintBuffer(size_t unused, size_t dropped);
+
+  void
+  aJsonGetMemoryStats(aJsonMemoryStats* stats);
+
+  void
+  aJsonResetMemoryStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* ALLOCATOR_H_ */
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "stringbuffer.h"
+#include "allocator.h"
 
 //Default buffer size for strings
 #define BUFFER_SIZE 256
@@ -34,7 +35,7 @@ char global_buffer[BUFFER_SIZE];
 string_buffer*
 stringBufferCreate(void)
 {
-  string_buffer* result = malloc(sizeof(string_buffer));
+  string_buffer* result = aJsonMalloc(sizeof(string_buffer));
   if (result == NULL)
     {
       return NULL;
@@ -95,14 +96,16 @@ stringBufferToString(string_buffer* buffer)
    buffer->string=NULL;
    free(buffer);
    return string;*/
-  char* result = malloc(buffer->string_length * sizeof(char));
+  // an escaped \u0000 ends the string early; allocate only what
+  // aJsonFreeString() will release again
+  char* result = aJsonMalloc((strlen(global_buffer) + 1) * sizeof(char));
   if (result == NULL)
     {
       return NULL;
     }
   strcpy(result, global_buffer);
   buffer->string = NULL;
-  free(buffer);
+  aJsonFree(buffer, sizeof(string_buffer));
   return result;
 }
 
@@ -120,6 +123,6 @@ stringBufferFree(string_buffer* buffer)
    free(buffer->string);
    }
    */
-  free(buffer);
+  aJsonFree(buffer, sizeof(string_buffer));
 }
 